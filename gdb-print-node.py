@@ -1,22 +1,25 @@
 
+import re
 import gdb
 import gdb.printing
 # from curses.ascii import isgraph
 
 class node_tPrinter(object):
     "Print a node_t"
-    
+
     def __init__(self, val):
         self.val = val
 
     def to_string(self):
-        return ("d=" + str(self.val["data"]) + " n=<" + str(self.val["nxt"]) + ">")
+        node = self.val["as_node"]
+        return ("d=" + str(node["data"]) + " n=<" + str(node["next"]) + ">")
 
     def display_hint(self):
         return 'string'
 
 def str_lookup_function(val):
-    lookup_tag = val.type.tag
+    # node_t is typedef of anonymous union, so look at name, not tag
+    lookup_tag = val.type.name
     if lookup_tag == None:
         return None
     regex = re.compile("^node_t$")
@@ -26,4 +29,25 @@ def str_lookup_function(val):
 
 gdb.pretty_printers.append(str_lookup_function)
 
-
+class queueArenaCommand(gdb.Command):
+    """Print arena occupancy and waste report of running program.
+Usage: queue-arena QUEUES N
+QUEUES is expression giving Q** (array of queue handles), N is number
+of queues in it. Calls printArenaReport() in inferior, so it needs
+live process; queues not in QUEUES are reported as other nodes."""
+
+    def __init__(self):
+        super(queueArenaCommand, self).__init__("queue-arena", gdb.COMMAND_DATA)
+
+    def invoke(self, arg, from_tty):
+        argv = gdb.string_to_argv(arg)
+        if len(argv) != 2:
+            raise gdb.GdbError("usage: queue-arena QUEUES N")
+        queues = gdb.parse_and_eval(argv[0])
+        if queues.type.strip_typedefs().code == gdb.TYPE_CODE_ARRAY:
+            queues = queues[0].address
+        n = int(gdb.parse_and_eval(argv[1]))
+        gdb.execute("call (void) printArenaReport((Q**) %d, %d)" % (int(queues), n), from_tty)
+        gdb.execute("call (int) fflush(0)", to_string=True)
+
+queueArenaCommand()
@@ -0,0 +1,74 @@
+#!/bin/env python3
+
+# Synthesizes workload trace for queue-replay (make replay), see replay.c
+# for format. Same arguments and seed give same trace.
+#
+#   gen_trace.py --queues 64 --length exp:40 --burst 8 --ops 200000 > t.txt
+
+import sys
+import random
+import argparse
+
+p = argparse.ArgumentParser(description="generate queue-replay trace")
+p.add_argument("--queues", type=int, default=16, help="queues in use at once, up to 256")
+p.add_argument("--length", default="exp:32",
+               help="target queue length distribution: fixed:N, uniform:A-B or exp:MEAN")
+p.add_argument("--burst", type=float, default=1.0,
+               help="mean ops in row on same queue before switching to other one")
+p.add_argument("--bulk", type=float, default=0.0, help="share of ops done with bulk api")
+p.add_argument("--bulk-len", type=int, default=64, help="max bytes of bulk op")
+p.add_argument("--churn", type=float, default=0.001,
+               help="chance queue is destroyed and created again when it drains")
+p.add_argument("--ops", type=int, default=100000)
+p.add_argument("--seed", type=int, default=1)
+a = p.parse_args()
+
+rnd = random.Random(a.seed)
+
+def target_length():
+    kind, _, arg = a.length.partition(":")
+    if kind == "fixed":
+        return int(arg)
+    if kind == "uniform":
+        lo, hi = arg.split("-")
+        return rnd.randint(int(lo), int(hi))
+    if kind == "exp":
+        return int(rnd.expovariate(1.0 / float(arg)))
+    sys.exit("bad --length " + a.length)
+
+out = sys.stdout
+out.write("# gen_trace.py %s\n" % " ".join(sys.argv[1:]))
+
+# each queue fills up to its target length, then drains, then gets new one
+length = [0] * a.queues
+target = [target_length() for _ in range(a.queues)]
+filling = [True] * a.queues
+for q in range(a.queues):
+    out.write("c %d\n" % q)
+
+ops = 0
+while ops < a.ops:
+    q = rnd.randrange(a.queues)
+    for _ in range(max(1, int(rnd.expovariate(1.0 / a.burst)))):
+        n = rnd.randint(1, a.bulk_len) if rnd.random() < a.bulk else 0
+        if filling[q]:
+            out.write("e %d %d\n" % (q, n) if n else "e %d\n" % q)
+            length[q] += max(n, 1)
+            filling[q] = length[q] < target[q]
+        else:
+            n = min(n, length[q])
+            out.write("d %d %d\n" % (q, n) if n else "d %d\n" % q)
+            length[q] -= max(n, 1)
+            if length[q] <= 0:
+                length[q] = 0
+                target[q] = target_length()
+                filling[q] = True
+                if rnd.random() < a.churn:
+                    out.write("x %d\nc %d\n" % (q, q))
+                    ops += 2
+        ops += 1
+        if ops >= a.ops:
+            break
+
+for q in range(a.queues):
+    out.write("x %d\n" % q)
@@ -11,6 +11,17 @@
 #include <unistd.h>
 #include <limits.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 
 #define BUFFER_LIMIT 2048
@@ -525,8 +536,1657 @@ static void test_6(void **state) // bug with destroy
 
 }
 
+static void test_7(void **state) // eventfd notifications
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    queueNotifier_t n = { eventfd(0, EFD_NONBLOCK), 0 };
+    assert_true(n.fd >= 0);
+    uint64_t cnt = 0;
+
+    Q* q0 = createQueue();
+    Q* q1 = createQueue();
+    setQueueNotifier(q0, &n);
+    setQueueNotifier(q1, &n);
+
+    // burst into one queue and transition of another - single wakeup
+    for (int i = 0; i < 100; i++)
+        enqueueByte(q0, i);
+    enqueueByte(q1, 1);
+
+    assert_int_equal(read(n.fd, &cnt, sizeof(cnt)), sizeof(cnt));
+    assert_int_equal(cnt, 1);
+    assert_int_equal(read(n.fd, &cnt, sizeof(cnt)), -1);
+
+    // nothing new until acked
+    assert_int_equal(dequeueByte(q1), 1);
+    enqueueByte(q1, 2);
+    assert_int_equal(read(n.fd, &cnt, sizeof(cnt)), -1);
+
+    ackQueueNotifier(&n);
+    assert_int_equal(n.pending, 0);
+
+    // non-empty queue does not signal
+    enqueueByte(q1, 3);
+    assert_int_equal(read(n.fd, &cnt, sizeof(cnt)), -1);
+
+    // drained queue signals again
+    assert_int_equal(dequeueByte(q1), 2);
+    assert_int_equal(dequeueByte(q1), 3);
+    enqueueByte(q1, 4);
+    assert_int_equal(n.pending, 1);
+    ackQueueNotifier(&n);
+
+    // detached queue is silent
+    setQueueNotifier(q1, NULL);
+    assert_int_equal(dequeueByte(q1), 4);
+    enqueueByte(q1, 5);
+    assert_int_equal(n.pending, 0);
+    assert_int_equal(read(n.fd, &cnt, sizeof(cnt)), -1);
+
+    destroyQueue(q0);
+    destroyQueue(q1);
+    close(n.fd);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_8(void **state) // try* api, no callbacks
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    unsigned char b = 0xAA;
+    Q* q0 = createQueue();
+
+    assert_int_equal(tryDequeue(q0, &b), QUEUE_EMPTY);
+    assert_int_equal(b, 0xAA);
+
+    for (int i = 0; i < metrics.max_els_in_single; i++)
+        assert_int_equal(tryEnqueue(q0, i), QUEUE_OK);
+
+    assert_int_equal(tryEnqueue(q0, 0), QUEUE_OUT_OF_MEM);
+
+    for (int i = 0; i < metrics.max_els_in_single; i++)
+    {
+        assert_int_equal(tryDequeue(q0, &b), QUEUE_OK);
+        assert_int_equal(b, i % 256);
+    }
+    assert_int_equal(tryDequeue(q0, &b), QUEUE_EMPTY);
+
+    // bulk
+    static unsigned char src[4096], dst[4096];
+    for (int i = 0; i < 4096; i++)
+        src[i] = rand();
+
+    assert_int_equal(tryEnqueueBytes(q0, src, 100), 100);
+    assert_int_equal(tryDequeueBytes(q0, dst, 4096), 100);
+    assert_memory_equal(src, dst, 100);
+
+    assert_int_equal(tryEnqueueBytes(q0, src, 4096), metrics.max_els_in_single);
+    assert_int_equal(tryDequeueBytes(q0, dst, 10), 10);
+    assert_int_equal(tryDequeueBytes(q0, dst + 10, 4096), metrics.max_els_in_single - 10);
+    assert_memory_equal(src, dst, metrics.max_els_in_single);
+
+    destroyQueue(q0);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static unsigned int wm_high_calls, wm_low_calls, wm_last;
+
+static void onHighWatermark(unsigned int used) { wm_high_calls++; wm_last = used; }
+static void onLowWatermark(unsigned int used)  { wm_low_calls++;  wm_last = used; }
+
+static void test_9(void **state) // quotas and watermarks
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    // max quota - 2 data nodes is 5 + 7 + 8 bytes
+    Q* q0 = createQueue();
+    assert_int_equal(setQueueQuota(q0, 0, 2), QUEUE_OK);
+    for (int i = 0; i < 20; i++)
+        assert_int_equal(tryEnqueue(q0, i), QUEUE_OK);
+    assert_int_equal(tryEnqueue(q0, 20), QUEUE_OVER_QUOTA);
+    enqueueByte(q0, 20);
+    assert_int_equal(has_out_of_mem, 1);
+    resetErrors();
+    for (int i = 0; i < 20; i++)
+        assert_int_equal(dequeueByte(q0), i);
+
+    // reserved nodes survive hog queue
+    assert_int_equal(setQueueQuota(q0, 10, 0), QUEUE_OK);
+    Q* hog = createQueue();
+    int hogged = 0;
+    while (tryEnqueue(hog, hogged) == QUEUE_OK)
+        hogged++;
+    assert_true(hogged < metrics.max_els_in_single);
+
+    int got = 0;
+    while (tryEnqueue(q0, got) == QUEUE_OK)
+        got++;
+    assert_int_equal(got, 5 + 8 + 9 * 7);
+
+    // can not reserve more than left, can not create queue over reservations
+    Q* q1 = createQueue();
+    assert_null(q1);
+    assert_int_equal(has_out_of_mem, 1);
+    resetErrors();
+
+    destroyQueue(hog);
+    destroyQueue(q0);
+
+    // full arena is reservable, but not more
+    q0 = createQueue();
+    assert_int_equal(setQueueQuota(q0, 254, 0), QUEUE_OK);
+    q1 = createQueue();
+    assert_null(q1);
+    resetErrors();
+    assert_int_equal(setQueueQuota(q0, 0, 0), QUEUE_OK);
+    q1 = createQueue();
+    assert_non_null(q1);
+    assert_int_equal(setQueueQuota(q0, 254, 0), QUEUE_OUT_OF_MEM);
+    destroyQueue(q1);
+    destroyQueue(q0);
+
+    // watermarks
+    wm_high_calls = wm_low_calls = 0;
+    setArenaWatermarks(20, 100, onHighWatermark, onLowWatermark);
+    q0 = createQueue();
+    for (int j = 0; j < 2; j++)
+    {
+        for (int i = 0; i < 1000; i++)
+            enqueueByte(q0, i);
+        assert_int_equal(wm_high_calls, j + 1);
+        assert_int_equal(wm_low_calls, j);
+        assert_in_range(wm_last, 100, 100 + 15); // extent may jump over
+
+        for (int i = 0; i < 1000; i++)
+            assert_int_equal(dequeueByte(q0), i % 256);
+        assert_int_equal(wm_low_calls, j + 1);
+        assert_in_range(wm_last, 0, 20); // head extent may free 32 at once
+    }
+    destroyQueue(q0);
+    setArenaWatermarks(0, 255, NULL, NULL);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_10(void **state) // typed and record api
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    Q* q0 = createQueue();
+
+    // mixed sizes at every root/tail offset
+    for (int off = 0; off < 20; off++)
+    {
+        for (int i = 0; i < off; i++)
+            enqueueByte(q0, 0xEE);
+
+        for (int i = 0; i < 50; i++)
+        {
+            assert_int_equal(tryEnqueueU16(q0, 0x1000 + i), QUEUE_OK);
+            assert_int_equal(tryEnqueueU32(q0, 0x20000000u + i), QUEUE_OK);
+            assert_int_equal(tryEnqueueU64(q0, 0x3000000000000000ull + i), QUEUE_OK);
+        }
+
+        for (int i = 0; i < off; i++)
+            assert_int_equal(dequeueByte(q0), 0xEE);
+
+        for (int i = 0; i < 50; i++)
+        {
+            uint16_t a; uint32_t b; uint64_t c;
+            assert_int_equal(tryDequeueU16(q0, &a), QUEUE_OK);
+            assert_int_equal(tryDequeueU32(q0, &b), QUEUE_OK);
+            assert_int_equal(tryDequeueU64(q0, &c), QUEUE_OK);
+            assert_int_equal(a, 0x1000 + i);
+            assert_int_equal(b, 0x20000000u + i);
+            assert_true(c == 0x3000000000000000ull + i);
+        }
+
+        uint16_t a;
+        assert_int_equal(tryDequeueU16(q0, &a), QUEUE_EMPTY);
+    }
+
+    // records larger than node, partial record is not dequeued
+    unsigned char rec[40], out[40];
+    for (int i = 0; i < 50; i++)
+    {
+        for (int j = 0; j < 40; j++)
+            rec[j] = i + j;
+        assert_int_equal(tryEnqueueRecord(q0, rec, 16 + i % 25), QUEUE_OK);
+    }
+    for (int i = 0; i < 50; i++)
+    {
+        assert_int_equal(tryDequeueRecord(q0, out, 16 + i % 25), QUEUE_OK);
+        for (int j = 0; j < 16 + i % 25; j++)
+            assert_int_equal(out[j], (unsigned char)(i + j));
+    }
+    enqueueByte(q0, 1);
+    assert_int_equal(tryDequeueRecord(q0, out, 2), QUEUE_EMPTY);
+    assert_int_equal(dequeueByte(q0), 1);
+
+    // record is all or nothing on out of memory
+    int cnt = 0;
+    while (tryEnqueueRecord(q0, rec, 40) == QUEUE_OK)
+        cnt += 40;
+    int rest = 0;
+    while (tryEnqueue(q0, 0) == QUEUE_OK)
+        rest++;
+    assert_true(rest < 40);
+    assert_int_equal(cnt + rest, metrics.max_els_in_single);
+
+    destroyQueue(q0);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_11(void **state) // messages
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    static unsigned char msg[1024], out[1024];
+    const int lens[] = { 0, 1, 4, 5, 6, 13, 127, 128, 129, 300, 1000 };
+    const int nlens = sizeof(lens) / sizeof(lens[0]);
+
+    for (int i = 0; i < 1024; i++)
+        msg[i] = rand();
+
+    Q* q0 = createQueue();
+    assert_int_equal(peekMessageLength(q0), QUEUE_EMPTY);
+    assert_int_equal(dequeueMessage(q0, out, sizeof(out)), QUEUE_EMPTY);
+
+    for (int i = 0; i < nlens; i++)
+    {
+        assert_int_equal(enqueueMessage(q0, msg + i, lens[i]), QUEUE_OK);
+        assert_int_equal(enqueueMessage(q0, msg, 3), QUEUE_OK);
+
+        assert_int_equal(peekMessageLength(q0), lens[i]);
+        if (lens[i] > 0)
+            assert_int_equal(dequeueMessage(q0, out, lens[i] - 1), QUEUE_TOO_SMALL);
+        assert_int_equal(dequeueMessage(q0, out, sizeof(out)), lens[i]);
+        assert_memory_equal(out, msg + i, lens[i]);
+
+        assert_int_equal(peekMessageLength(q0), 3);
+        assert_int_equal(dequeueMessage(q0, out, 3), 3);
+        assert_memory_equal(out, msg, 3);
+        assert_int_equal(peekMessageLength(q0), QUEUE_EMPTY);
+    }
+
+    // fill up, last message is rejected as a whole
+    int cnt = 0;
+    while (enqueueMessage(q0, msg, 100) == QUEUE_OK)
+        cnt++;
+    assert_int_equal(cnt, metrics.max_els_in_single / 101);
+    for (int i = 0; i < cnt; i++)
+        assert_int_equal(dequeueMessage(q0, out, sizeof(out)), 100);
+    assert_int_equal(dequeueMessage(q0, out, sizeof(out)), QUEUE_EMPTY);
+
+    destroyQueue(q0);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_12(void **state) // priority groups
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    queuePrioGroup_t g;
+    initPrioGroup(&g);
+
+    Q* qs[QUEUE_PRIO_LEVELS];
+    for (int i = 0; i < QUEUE_PRIO_LEVELS; i++)
+    {
+        qs[i] = createQueue();
+        bindPrioQueue(&g, i, qs[i]);
+    }
+
+    unsigned char b;
+    assert_int_equal(dequeueHighest(&g, &b), QUEUE_EMPTY);
+
+    // already non-empty queue is seen on bind
+    enqueueByte(qs[63], 63);
+    bindPrioQueue(&g, 63, qs[63]);
+    assert_true(g.ready == 1ull << 63);
+
+    for (int i = 62; i >= 0; i -= 3)
+        for (int j = 0; j < 10; j++)
+            enqueueByte(qs[i], i);
+
+    for (int i = 2; i < 63; i += 3)
+        for (int j = 0; j < 10; j++)
+        {
+            assert_int_equal(dequeueHighest(&g, &b), i);
+            assert_int_equal(b, i);
+        }
+    assert_int_equal(dequeueHighest(&g, &b), 63);
+    assert_int_equal(dequeueHighest(&g, &b), QUEUE_EMPTY);
+
+    // bulk dequeue clears level too
+    tryEnqueueBytes(qs[5], (const unsigned char*)"abcdefghij", 10);
+    unsigned char out[10];
+    assert_int_equal(tryDequeueBytes(qs[5], out, 10), 10);
+    assert_true(g.ready == 0);
+
+    // unbind and destroy
+    enqueueByte(qs[1], 1);
+    enqueueByte(qs[2], 2);
+    bindPrioQueue(&g, 1, NULL);
+    destroyQueue(qs[2]);
+    assert_int_equal(dequeueHighest(&g, &b), QUEUE_EMPTY);
+    assert_int_equal(dequeueByte(qs[1]), 1);
+
+    for (int i = 0; i < QUEUE_PRIO_LEVELS; i++)
+        if (i != 2)
+            destroyQueue(qs[i]);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_13(void **state) // readiness set
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    const int N = 200;
+    Q* qs[N];
+    for (int i = 0; i < N; i++)
+        qs[i] = createQueue();
+
+    unsigned int it = 0;
+    assert_null(nextReadyQueue(&it));
+    it = 0;
+    assert_null(pollReadyQueue(&it));
+    assert_int_equal(countReadyQueues(), 0);
+
+    for (int i = 0; i < N; i += 7)
+    {
+        enqueueByte(qs[i], i);
+        enqueueByte(qs[i], i);
+    }
+
+    // iteration sees exactly non-empty ones in handle order
+    int seen = 0;
+    Q* q;
+    Q* prev = NULL;
+    it = 0;
+    while ((q = nextReadyQueue(&it)) != NULL)
+    {
+        int i = 0;
+        while (qs[i] != q)
+            i++;
+        assert_int_equal(i % 7, 0);
+        assert_true(prev < q);
+        prev = q;
+        seen++;
+    }
+    assert_int_equal(seen, (N + 6) / 7);
+    assert_int_equal(countReadyQueues(), seen);
+
+    // round robin serves everyone once per round, then drains
+    unsigned int cursor = 0;
+    Q* round[N];
+    for (int r = 0; r < 2; r++)
+        for (int k = 0; k < seen; k++)
+        {
+            q = pollReadyQueue(&cursor);
+            assert_non_null(q);
+            if (r == 0)
+            {
+                for (int j = 0; j < k; j++)
+                    assert_ptr_not_equal(round[j], q);
+                round[k] = q;
+            }
+            else
+                assert_ptr_equal(round[k], q);
+            dequeueByte(q);
+        }
+    assert_null(pollReadyQueue(&cursor));
+    assert_int_equal(countReadyQueues(), 0);
+
+    enqueueByte(qs[0], 0);
+    enqueueByte(qs[1], 1);
+    for (int i = 0; i < N; i++)
+        destroyQueue(qs[i]);
+    assert_int_equal(countReadyQueues(), 0);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_14(void **state) // compaction
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    const int N = 16;
+    Q* qs[N];
+    int lens[N];
+
+    queuePrioGroup_t g;
+    initPrioGroup(&g);
+
+    // interleaved churn to scatter chains over free list
+    for (int i = 0; i < N; i++)
+    {
+        qs[i] = createQueue();
+        lens[i] = 0;
+    }
+    for (int r = 0; r < 40; r++)
+        for (int i = 0; i < N; i++)
+        {
+            int add = lens[i] < 80 ? rand() % 9 : 0;
+            for (int j = 0; j < add; j++)
+                enqueueByte(qs[i], lens[i]++);
+            if (lens[i] > 20 && rand() % 2)
+            {
+                int k = rand() % 20;
+                for (int j = 0; j < k; j++)
+                    dequeueByte(qs[i]);
+                for (int j = 0; j < lens[i] - k; j++) // renumber
+                    enqueueByte(qs[i], dequeueByte(qs[i]) - k);
+                lens[i] -= k;
+            }
+        }
+    bindPrioQueue(&g, 3, qs[5]);
+
+    // queue left out or passed twice would be lost: nothing moves
+    Q* first = qs[0];
+    assert_false(compactArena(qs + 1, N - 1));
+    assert_int_equal(has_illegal_op, 1);
+    has_illegal_op = 0;
+    qs[0] = qs[1];
+    assert_false(compactArena(qs, N));
+    assert_int_equal(has_illegal_op, 1);
+    has_illegal_op = 0;
+    qs[0] = first;
+
+    // every live queue and one of them again, node count matches
+    Q* again[N + 1];
+    memcpy(again, qs, sizeof(qs));
+    again[N] = qs[2];
+    assert_false(compactArena(again, N + 1));
+    assert_int_equal(has_illegal_op, 1);
+    has_illegal_op = 0;
+    assert_memory_equal(again, qs, sizeof(qs));
+
+    assert_true(compactArena(qs, N));
+
+    // roots and chains are packed from first node on
+    assert_ptr_equal(qs[0], buffer + 8);
+    assert_ptr_equal(g.levels[3], qs[5]);
+    assert_int_equal(countReadyQueues(), N);
+
+    for (int i = 0; i < N; i++)
+    {
+        enqueueByte(qs[i], lens[i]);
+        for (int j = 0; j <= lens[i]; j++)
+            assert_int_equal(dequeueByte(qs[i]), j % 256);
+    }
+
+    unsigned char b;
+    assert_int_equal(dequeueHighest(&g, &b), QUEUE_EMPTY);
+
+    for (int i = 0; i < N; i++)
+        destroyQueue(qs[i]);
+
+    // free space is single bump region again
+    Q* q0 = createQueue();
+    compactArena(&q0, 1);
+    for (int i = 0; i < metrics.max_els_in_single; i++)
+        assert_int_equal(tryEnqueue(q0, i), QUEUE_OK);
+    compactArena(&q0, 1);
+    for (int i = 0; i < metrics.max_els_in_single; i++)
+        assert_int_equal(dequeueByte(q0), i % 256);
+    destroyQueue(q0);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void scatter_free_list(void) // free list jumping cache lines
+{
+    const int N = 64;
+    Q* qs[N];
+
+    for (int i = 0; i < N; i++)
+        qs[i] = createQueue();
+    for (int i = 0; i < N; i++)
+        destroyQueue(qs[(i % 8) * 8 + i / 8]);
+}
+
+static void test_15(void **state) // node placement
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    const int LEN = 7 * 14; // stays below wide chunk promotion
+    unsigned int crossings[2];
+
+    for (int p = QUEUE_ALLOC_LIFO; p <= QUEUE_ALLOC_NEAR_TAIL; p++)
+    {
+        setAllocPolicy(p);
+        scatter_free_list();
+
+        Q* q = createQueue();
+        for (int i = 0; i < LEN; i++)
+            enqueueByte(q, i);
+        crossings[p] = queueLineCrossings(q);
+        for (int i = 0; i < LEN; i++)
+            assert_int_equal(dequeueByte(q), i % 256);
+        destroyQueue(q);
+    }
+
+    // 14 nodes: line changes on almost every node vs once per line
+    assert_true(crossings[QUEUE_ALLOC_LIFO] > 10);
+    assert_true(crossings[QUEUE_ALLOC_NEAR_TAIL] < 5);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_16(void **state) // wide chunks
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    Q* q0 = createQueue();
+    unsigned int head = 0, tail = 0; // model: byte i is i % 251
+
+    // long queue is mostly laid in whole cache lines
+    while (tail < 1000)
+        enqueueByte(q0, tail++ % 251);
+    assert_true(queueLineCrossings(q0) < 30);
+
+    // tail chunk is also head: dequeue and enqueue in same chunk
+    while (tail - head > 40)
+        assert_int_equal(dequeueByte(q0), head++ % 251);
+    for (int i = 0; i < 3000; i++)
+    {
+        enqueueByte(q0, tail++ % 251);
+        assert_int_equal(dequeueByte(q0), head++ % 251);
+    }
+
+    // bulk over wide chunks
+    unsigned char buf[700];
+    for (int r = 0; r < 20; r++)
+    {
+        for (int i = 0; i < 700; i++)
+            buf[i] = (tail + i) % 251;
+        assert_int_equal(tryEnqueueBytes(q0, buf, 700), 700);
+        tail += 700;
+
+        unsigned int n = 650 + r;
+        assert_int_equal(tryDequeueBytes(q0, buf, n), n);
+        for (unsigned int i = 0; i < n; i++)
+            assert_int_equal(buf[i], (head + i) % 251);
+        head += n;
+    }
+
+    // drained queue gets plain nodes back, capacity is same as before
+    while (head < tail)
+        assert_int_equal(dequeueByte(q0), head++ % 251);
+    for (int i = 0; i < metrics.max_els_in_single; i++)
+        assert_int_equal(tryEnqueue(q0, i), QUEUE_OK);
+    assert_int_equal(tryEnqueue(q0, 0), QUEUE_OUT_OF_MEM);
+
+    // queue holding whole arena is few extents, compaction keeps them
+    unsigned int crossings = queueLineCrossings(q0);
+    assert_true(crossings < 20);
+    compactArena(&q0, 1);
+    assert_true(queueLineCrossings(q0) <= crossings);
+    for (int i = 0; i < metrics.max_els_in_single; i++)
+        assert_int_equal(dequeueByte(q0), i % 256);
+
+    destroyQueue(q0);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_17(void **state) // run nodes
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    Q* q0 = createQueue();
+    setQueueFlags(q0, QUEUE_FLAG_RLE);
+
+    // runs take no more nodes, far beyond normal capacity
+    for (int i = 0; i < 10 * metrics.max_els_in_single; i++)
+        assert_int_equal(tryEnqueue(q0, 0x55), QUEUE_OK);
+    enqueueByte(q0, 1);
+    for (int i = 0; i < 10 * metrics.max_els_in_single; i++)
+        assert_int_equal(dequeueByte(q0), 0x55);
+    assert_int_equal(dequeueByte(q0), 1);
+
+    // mixed runs and data, bulk and byte api
+    static unsigned char src[3000], dst[3000];
+    for (int i = 0; i < 3000; i++)
+        src[i] = i % 500 < 100 ? rand() : i / 500 + 1;
+
+    assert_int_equal(tryEnqueueBytes(q0, src, 3000), 3000);
+    for (int i = 0; i < 3000; i++)
+        enqueueByte(q0, src[i]);
+
+    assert_int_equal(tryDequeueBytes(q0, dst, 1500), 1500);
+    for (int i = 1500; i < 3000; i++)
+        dst[i] = dequeueByte(q0);
+    assert_memory_equal(src, dst, 3000);
+    assert_int_equal(tryDequeueBytes(q0, dst, 3000), 3000);
+    assert_memory_equal(src, dst, 3000);
+    assert_int_equal(tryDequeue(q0, dst), QUEUE_EMPTY);
+
+    // message of zeros, header is peeked over run
+    memset(src, 0, 3000);
+    assert_int_equal(enqueueMessage(q0, src, 3000), QUEUE_OK);
+    assert_int_equal(enqueueMessage(q0, src, 3000), QUEUE_OK);
+    assert_int_equal(dequeueMessage(q0, dst, 3000), 3000);
+    assert_int_equal(peekMessageLength(q0), 3000);
+    assert_int_equal(dequeueMessage(q0, dst, 3000), 3000);
+    assert_memory_equal(src, dst, 3000);
+
+    // long queue with wide tail gets run node after it
+    for (int i = 0; i < 600; i++)
+        enqueueByte(q0, i % 251);
+    for (int i = 0; i < 20000; i++)
+        enqueueByte(q0, 0);
+    uint32_t v;
+    for (int i = 0; i < 600 / 4; i++)
+        assert_int_equal(tryDequeueU32(q0, &v), QUEUE_OK);
+    for (int i = 0; i < 20000 / 4; i++)
+    {
+        assert_int_equal(tryDequeueU32(q0, &v), QUEUE_OK);
+        assert_int_equal(v, 0);
+    }
+    assert_int_equal(tryDequeue(q0, dst), QUEUE_EMPTY);
+
+    destroyQueue(q0);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static unsigned char spill_pattern(int i)
+{
+    return i * 7 + i / 300;
+}
+
+static void test_18(void **state) // spill tier
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    FILE* f = tmpfile();
+    assert_non_null(f);
+    setSpillFile(fileno(f));
+
+    Q* q0 = createQueue();
+    Q* q1 = createQueue();
+    for (int i = 0; i < 300; i++)
+        enqueueByte(q1, i);
+
+    // far beyond arena, interleaved with other queue
+    const int LEN = 50000;
+    for (int i = 0; i < LEN; i++)
+    {
+        assert_int_equal(tryEnqueue(q0, spill_pattern(i)), QUEUE_OK);
+        if (i % 100 == 0)
+            enqueueByte(q1, dequeueByte(q1));
+    }
+    for (int i = 0; i < LEN / 2; i++)
+        assert_int_equal(dequeueByte(q0), spill_pattern(i));
+
+    // paged in nodes stay resident, next spill goes after them
+    for (int i = LEN; i < 2 * LEN; i++)
+        enqueueByte(q0, spill_pattern(i));
+    for (int i = LEN / 2; i < 2 * LEN; i++)
+        assert_int_equal(dequeueByte(q0), spill_pattern(i));
+    unsigned char b;
+    assert_int_equal(tryDequeue(q0, &b), QUEUE_EMPTY);
+
+    // bulk and messages, each one still has to fit in arena
+    static unsigned char src[1000], dst[1000];
+    for (int r = 0; r < 40; r++)
+    {
+        for (int i = 0; i < 1000; i++)
+            src[i] = spill_pattern(r * 1000 + i);
+        assert_int_equal(tryEnqueueBytes(q0, src, 500), 500);
+        assert_int_equal(enqueueMessage(q0, src, 1000), QUEUE_OK);
+    }
+    for (int r = 0; r < 40; r++)
+    {
+        for (int i = 0; i < 1000; i++)
+            src[i] = spill_pattern(r * 1000 + i);
+        assert_int_equal(tryDequeueBytes(q0, dst, 500), 500);
+        assert_memory_equal(src, dst, 500);
+        assert_int_equal(peekMessageLength(q0), 1000);
+        assert_int_equal(dequeueMessage(q0, dst, 1000), 1000);
+        assert_memory_equal(src, dst, 1000);
+    }
+
+    // runs stay resident, data after them is spilled
+    setQueueFlags(q0, QUEUE_FLAG_RLE);
+    for (int i = 0; i < LEN; i++)
+        enqueueByte(q0, i % 5000 < 1000 ? 0 : spill_pattern(i));
+    for (int i = 0; i < LEN; i++)
+        assert_int_equal(dequeueByte(q0), i % 5000 < 1000 ? 0 : spill_pattern(i));
+
+    for (int i = 0; i < 300; i++) // rotated LEN / 100 times
+        assert_int_equal(dequeueByte(q1), (unsigned char) ((i + LEN / 100) % 300));
+    destroyQueue(q1);
+
+    // failed read back leaves data spilled, try api reports it
+    setQueueFlags(q0, 0);
+    for (int i = 0; i < LEN; i++)
+        enqueueByte(q0, spill_pattern(i));
+    int keep = dup(fileno(f));
+    int wo = open("/dev/null", O_WRONLY);
+    assert_true(keep >= 0 && wo >= 0);
+    dup2(wo, fileno(f)); // pread fails with EBADF
+
+    int at = 0, n;
+    while ((n = tryDequeueBytes(q0, dst, 100)) > 0)
+    {
+        for (int i = 0; i < n; i++)
+            assert_int_equal(dst[i], spill_pattern(at + i));
+        at += n;
+    }
+    assert_int_equal(n, QUEUE_IO_ERROR);
+    assert_true(at < LEN);
+    assert_int_equal(tryDequeue(q0, &b), QUEUE_IO_ERROR);
+    uint32_t u;
+    assert_int_equal(tryDequeueU32(q0, &u), QUEUE_IO_ERROR);
+    int p[2];
+    assert_int_equal(pipe(p), 0);
+    assert_int_equal(queueWriteToFd(q0, p[1], 100), -1);
+    assert_int_equal(errno, EIO);
+    close(p[0]);
+    close(p[1]);
+    assert_int_equal(has_illegal_op, 0);
+
+    dup2(keep, fileno(f));
+    close(keep);
+    close(wo);
+    for (; at < LEN; at++)
+        assert_int_equal(dequeueByte(q0), spill_pattern(at));
+    assert_int_equal(tryDequeue(q0, &b), QUEUE_EMPTY);
+
+    // without spill file arena is the limit again
+    setSpillFile(-1);
+    fclose(f);
+    setQueueFlags(q0, 0);
+    int cnt = 0;
+    while (tryEnqueue(q0, 1) == QUEUE_OK)
+        cnt++;
+    assert_int_equal(cnt, metrics.max_els_in_single);
+    destroyQueue(q0);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+#define SEGMENT_POOL 7
+static unsigned char segment_pool[SEGMENT_POOL][QUEUE_SEGMENT_SIZE] __attribute__((aligned(64)));
+static int segment_used[SEGMENT_POOL];
+static int segments_out;
+static int segment_limit;
+
+static unsigned char* allocSegment()
+{
+    for (int i = 0; i < SEGMENT_POOL && segments_out < segment_limit; i++)
+        if (!segment_used[i])
+        {
+            segment_used[i] = 1;
+            segments_out++;
+            return segment_pool[i];
+        }
+    return NULL;
+}
+
+static void freeSegment(unsigned char* seg)
+{
+    int i = (seg - segment_pool[0]) / QUEUE_SEGMENT_SIZE;
+    assert_true(segment_used[i]);
+    segment_used[i] = 0;
+    segments_out--;
+}
+
+static void test_19(void **state) // segmented arena
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    // 2 segments in buffer, 6 more on demand
+    initQueues(buffer, 2 * QUEUE_SEGMENT_SIZE);
+    setSegmentProvider(allocSegment, freeSegment);
+    segment_limit = SEGMENT_POOL - 1;
+
+    Q* q0 = createQueue();
+    for (int i = 0; i < metrics.max_els_in_single; i++)
+        assert_int_equal(tryEnqueue(q0, i), QUEUE_OK);
+    assert_int_equal(segments_out, 6);
+    assert_int_equal(tryEnqueue(q0, 0), QUEUE_OUT_OF_MEM);
+    for (int i = 0; i < metrics.max_els_in_single; i++)
+        assert_int_equal(dequeueByte(q0), (unsigned char) i);
+
+    assert_int_equal(releaseArenaSegments(), 6);
+    assert_int_equal(segments_out, 0);
+
+    // nodes left in top segments are packed down first
+    Q* qs[3];
+    for (int i = 0; i < 3; i++)
+        qs[i] = createQueue();
+    for (int i = 0; i < 300; i++)
+        for (int j = 0; j < 3; j++)
+            enqueueByte(qs[j], i);
+    assert_int_equal(segments_out, 3);
+    destroyQueue(qs[0]);
+    destroyQueue(qs[2]);
+    assert_int_equal(releaseArenaSegments(), 0);
+
+    Q* live[] = { q0, qs[1] };
+    compactArena(live, 2);
+    assert_int_equal(releaseArenaSegments(), 3);
+    assert_int_equal(segments_out, 0);
+    for (int i = 0; i < 300; i++)
+        assert_int_equal(dequeueByte(live[1]), (unsigned char) i);
+    destroyQueue(live[1]);
+
+    // provider running dry is out of memory
+    segment_limit = 1;
+    int cnt = 0;
+    while (tryEnqueue(live[0], 1) == QUEUE_OK)
+        cnt++;
+    assert_in_range(cnt, 3 * 32 * 7 - 20, 3 * 32 * 7);
+    assert_int_equal(segments_out, 1);
+
+    // new arena gives segments back
+    metrics = initQueues(buffer, BUFFER_LIMIT);
+    assert_int_equal(segments_out, 0);
+    setSegmentProvider(NULL, NULL);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
+static void test_20(void **state) // queue clones
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    // 5 copies of 600 bytes would not fit arena, shared chain does
+    Q* q0 = createQueue();
+    for (int i = 0; i < 600; i++)
+        enqueueByte(q0, i * 7);
+
+    Q* c[4];
+    for (int k = 0; k < 4; k++)
+    {
+        c[k] = cloneQueue(q0);
+        assert_non_null(c[k]);
+    }
+
+    // shared nodes are not moved
+    Q* live[] = { q0, c[0], c[1], c[2], c[3] };
+    compactArena(live, 5);
+    assert_ptr_equal(live[0], q0);
+
+    // queues diverge after clone
+    for (int i = 0; i < 100; i++)
+    {
+        enqueueByte(q0, i);
+        enqueueByte(c[0], 255 - i);
+    }
+
+    unsigned char buf[700];
+    for (int i = 0; i < 10; i++)
+        assert_int_equal(dequeueByte(c[1]), (unsigned char) (i * 7));
+    assert_int_equal(tryDequeueBytes(c[1], buf, sizeof(buf)), 590);
+    for (int i = 10; i < 600; i++)
+        assert_int_equal(buf[i - 10], (unsigned char) (i * 7));
+
+    // clone of clone keeps what its source got after it was cloned
+    Q* cc = cloneQueue(c[0]);
+    assert_non_null(cc);
+    destroyQueue(c[2]);
+
+    Q* tails[] = { q0, c[0], cc, c[3] };
+    for (int k = 0; k < 4; k++)
+    {
+        int len = k == 3 ? 600 : 700;
+        for (int i = 0; i < len; i++)
+        {
+            unsigned char b;
+            assert_int_equal(tryDequeue(tails[k], &b), QUEUE_OK);
+            unsigned char e = i < 600 ? i * 7 : k == 0 ? i - 600 : 255 - (i - 600);
+            assert_int_equal(b, e);
+        }
+        assert_int_equal(tryDequeueBytes(tails[k], buf, 1), 0);
+    }
+
+    // all nodes come back
+    for (int k = 0; k < 4; k++)
+        destroyQueue(tails[k]);
+    destroyQueue(c[1]);
+    Q* q = createQueue();
+    int cnt = 0;
+    while (tryEnqueue(q, 1) == QUEUE_OK)
+        cnt++;
+    assert_int_equal(cnt, metrics.max_els_in_single);
+    destroyQueue(q);
+
+    // draining quota queue whose nodes clone still holds frees only
+    // its own tail, so quota reserves no more than that one node
+    Q* a = createQueue();
+    assert_int_equal(setQueueQuota(a, 3, 0), QUEUE_OK);
+    for (int i = 0; i < 40; i++)
+        enqueueByte(a, i);
+    Q* b = cloneQueue(a);
+    assert_non_null(b);
+    Q* f = createQueue();
+    while (tryEnqueue(f, 1) == QUEUE_OK)
+        ;
+    assert_int_equal(tryDequeueBytes(a, buf, 100), 40);
+    assert_true(tryEnqueueBytes(f, buf, 100) < 8); // tail room only
+    assert_int_equal(tryEnqueueBytes(a, buf, 100), 5 + 8);
+    assert_int_equal(tryEnqueue(a, 0), QUEUE_OUT_OF_MEM);
+    for (int i = 0; i < 40; i++)
+        assert_int_equal(dequeueByte(b), i);
+    destroyQueue(b);
+    destroyQueue(f);
+    assert_int_equal(tryDequeueBytes(a, buf, 100), 5 + 8);
+    destroyQueue(a);
+
+    q = createQueue();
+    for (cnt = 0; tryEnqueue(q, 1) == QUEUE_OK; )
+        cnt++;
+    assert_int_equal(cnt, metrics.max_els_in_single);
+    destroyQueue(q);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_21(void **state) // capacity reservation
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    Q* big = createQueue();
+    Q* q = createQueue();
+    while (tryEnqueue(big, 1) == QUEUE_OK)
+        ;
+    unsigned char buf[100];
+    assert_int_equal(tryDequeueBytes(big, buf, 100), 100);
+
+    // reserved nodes are not given to other queues
+    assert_int_equal(reserveCapacity(q, 60), QUEUE_OK);
+    int cnt = 0;
+    while (tryEnqueue(big, 1) == QUEUE_OK)
+        cnt++;
+    assert_in_range(cnt, 100 - 60 - 8, 100 - 60 + 8);
+    for (int i = 0; i < 60; i++)
+        assert_int_equal(tryEnqueue(q, i), QUEUE_OK);
+
+    // failed reservation keeps old one, nbytes 0 releases it
+    assert_int_equal(reserveCapacity(q, 1000), QUEUE_OUT_OF_MEM);
+    assert_int_equal(tryDequeueBytes(q, buf, 100), 60);
+    assert_int_equal(reserveCapacity(q, 50), QUEUE_OK);
+    cnt = 0;
+    while (tryEnqueue(big, 1) == QUEUE_OK)
+        cnt++;
+    assert_in_range(cnt, 0, 60 - 50 + 8);
+    assert_int_equal(reserveCapacity(q, 1000), QUEUE_OUT_OF_MEM);
+    assert_int_equal(tryEnqueueBytes(q, buf, 50), 50);
+    assert_int_equal(tryDequeueBytes(q, buf, 100), 50);
+    assert_int_equal(reserveCapacity(q, 50), QUEUE_OK);
+    assert_int_equal(reserveCapacity(q, 0), QUEUE_OK);
+    cnt = 0;
+    while (tryEnqueue(big, 1) == QUEUE_OK)
+        cnt++;
+    assert_in_range(cnt, 50 - 8, 50 + 8);
+
+    // quota limits reservation too
+    destroyQueue(big);
+    assert_int_equal(setQueueQuota(q, 0, 4), QUEUE_OK);
+    assert_int_equal(reserveCapacity(q, 100), QUEUE_OVER_QUOTA);
+    assert_int_equal(reserveCapacity(q, 5 + 8 + 3 * 7), QUEUE_OK);
+    assert_int_equal(tryEnqueueBytes(q, buf, 5 + 8 + 3 * 7), 5 + 8 + 3 * 7);
+    assert_int_equal(tryEnqueue(q, 0), QUEUE_OVER_QUOTA);
+    destroyQueue(q);
+
+    // arena filled up to reservation of long run queue: runs cut by
+    // single bytes take wide chunks and run nodes, byte by byte or bulk
+    for (int off = 0; off < 40; off++)
+    {
+        Q* w = createQueue();
+        setQueueFlags(w, QUEUE_FLAG_RLE);
+        for (int i = 0; i < 100 + 7 * (off / 2); i++)
+            assert_int_equal(tryEnqueue(w, i), QUEUE_OK);
+        assert_int_equal(reserveCapacity(w, 400), QUEUE_OK);
+        big = createQueue();
+        while (tryEnqueue(big, 1) == QUEUE_OK)
+            ;
+
+        unsigned char src[400];
+        for (int i = 0; i < 400; i++)
+            src[i] = i % 10 < 9 ? 'a' : 'b' + i % 7;
+        if (off % 2 == 0)
+            for (int i = 0; i < 400; i++)
+                assert_int_equal(tryEnqueue(w, src[i]), QUEUE_OK);
+        else
+            for (int i = 0; i < 400; i += 8)
+                assert_int_equal(tryEnqueueBytes(w, src + i, 8), 8);
+        destroyQueue(big);
+        destroyQueue(w);
+    }
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+#ifdef QUEUE_INLINE
+static void test_22(void **state) // inline byte api
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    // inline and called api mixed on same queues, through all node kinds
+    Q* q0 = createQueue();
+    Q* q1 = createQueue();
+    setQueueFlags(q1, QUEUE_FLAG_RLE);
+    unsigned char b;
+
+    for (int round = 0; round < 3; round++)
+    {
+        int len = round == 0 ? 20 : round == 1 ? 300 : 1000;
+        for (int i = 0; i < len; i++)
+        {
+            if (i % 3 == 0)
+                enqueueByte(q0, i);
+            else
+                enqueueByteInline(q0, i);
+            assert_int_equal(tryEnqueueInline(q1, i / 50), QUEUE_OK);
+        }
+        for (int i = 0; i < len; i++)
+        {
+            assert_int_equal(i % 5 == 0 ? dequeueByte(q0) : dequeueByteInline(q0), (unsigned char) i);
+            assert_int_equal(tryDequeueInline(q1, &b), QUEUE_OK);
+            assert_int_equal(b, i / 50);
+        }
+        assert_int_equal(tryDequeueInline(q0, &b), QUEUE_EMPTY);
+    }
+
+    destroyQueue(q0);
+    destroyQueue(q1);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+#endif
+
+#ifdef QUEUE_TRACE
+static void test_23(void **state) // trace ring
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    // single root, then chain with alloc, then drain with free
+    Q* q = createQueue();
+    unsigned char buf[64];
+    unsigned char b;
+
+    enqueueByte(q, 1);
+    assert_int_equal(tryEnqueueBytes(q, buf, sizeof(buf)), sizeof(buf));
+    assert_int_equal(dequeueByte(q), 1);
+    assert_int_equal(tryDequeueBytes(q, buf, sizeof(buf)), sizeof(buf));
+    assert_int_equal(tryDequeue(q, &b), QUEUE_EMPTY);
+
+    FILE* f = tmpfile();
+    int n = queueTraceDump(fileno(f));
+    assert_true(n >= 5);
+    rewind(f);
+
+    queueTraceHeader_t h;
+    assert_int_equal(fread(&h, sizeof(h), 1, f), 1);
+    assert_memory_equal(h.magic, "QTRC", 4);
+    assert_int_equal(h.version, 1);
+    assert_int_equal(h.event_size, sizeof(queueTraceEvent_t));
+    assert_int_equal(h.count, n);
+    assert_true(h.tsc_dump >= h.tsc_base && h.ns_dump >= h.ns_base);
+
+    // ours are the last five, oldest first
+    queueTraceEvent_t e[5];
+    fseek(f, sizeof(h) + (n - 5) * sizeof(queueTraceEvent_t), SEEK_SET);
+    assert_int_equal(fread(e, sizeof(e[0]), 5, f), 5);
+    fclose(f);
+
+    assert_int_equal(e[0].op, QUEUE_TRACE_ENQ);
+    assert_int_equal(e[0].path, QUEUE_TRACE_SINGLE);
+    assert_int_equal(e[1].op, QUEUE_TRACE_ENQ_BULK);
+    assert_int_equal(e[1].path, QUEUE_TRACE_ALLOC);
+    assert_int_equal(e[2].op, QUEUE_TRACE_DEQ);
+    assert_int_equal(e[3].op, QUEUE_TRACE_DEQ_BULK);
+    assert_int_equal(e[3].path, QUEUE_TRACE_FREE);
+    assert_int_equal(e[4].op, QUEUE_TRACE_DEQ);
+    assert_int_equal(e[4].status, QUEUE_EMPTY);
+    for (int i = 0; i < 5; i++)
+    {
+        assert_int_equal(e[i].root, e[0].root);
+        assert_true(i == 0 || e[i].tsc >= e[i - 1].tsc);
+    }
+
+    destroyQueue(q);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+#endif
+
+static void test_24(void **state) // arena stats
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    Q* q[4];
+    for (int i = 0; i < 4; i++)
+        q[i] = createQueue();
+    setQueueFlags(q[3], QUEUE_FLAG_RLE);
+
+    for (int i = 0; i < 3; i++)
+        enqueueByte(q[1], i);
+    for (int i = 0; i < 100; i++)
+        enqueueByte(q[2], i);
+    for (int i = 0; i < 500; i++)
+        enqueueByte(q[3], 7);
+
+    queueArenaStats_t s;
+    getArenaStats(q, 4, &s);
+
+    assert_int_equal(s.queues, 4);
+    assert_int_equal(s.root.nodes, 4);
+    assert_int_equal(s.root.bytes, 3 + 5 + 5);
+    assert_int_equal(s.root.slots, 4 * 5);
+    assert_int_equal(s.root.bytes + s.normal.bytes + s.tail.bytes + s.run_bytes, 603);
+    assert_true(s.run_nodes >= 1);
+    assert_true(s.normal.bytes <= s.normal.slots && s.tail.bytes <= s.tail.slots);
+    assert_int_equal(s.queue_nodes, 4 + s.normal.nodes + s.tail.nodes + s.run_nodes);
+
+    // every node is somewhere
+    assert_int_equal(1 + s.queue_nodes + s.other_nodes + s.free_nodes + s.bump_nodes, s.arena_nodes);
+    assert_true(s.used_lines * 8 >= 1 + s.queue_nodes);
+
+    // queue left out is counted as other
+    queueArenaStats_t t;
+    getArenaStats(q, 2, &t);
+    assert_int_equal(t.queue_nodes + t.other_nodes, s.queue_nodes + s.other_nodes);
+
+    printArenaReport(q, 4);
+
+    for (int i = 0; i < 4; i++)
+        destroyQueue(q[i]);
+
+    getArenaStats(NULL, 0, &t);
+    assert_int_equal(t.free_nodes + t.bump_nodes, s.free_nodes + s.bump_nodes + s.queue_nodes);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_25(void **state) // segment walk
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    Q* q = createQueue();
+    queueSegment_t seg;
+    unsigned int it = QUEUE_SEGMENTS_BEGIN;
+    assert_int_equal(nextQueueSegment(q, &it, &seg), 0);
+
+    // single root, then chain with wide chunks
+    for (int len = 3; len <= 600; len *= 20)
+    {
+        for (int i = 0; i < len; i++)
+            enqueueByte(q, i);
+        dequeueByte(q);
+
+        unsigned char out[600];
+        unsigned int got = 0;
+        for (it = QUEUE_SEGMENTS_BEGIN; nextQueueSegment(q, &it, &seg); )
+        {
+            assert_non_null(seg.data);
+            assert_true(seg.len > 0);
+            memcpy(out + got, seg.data, seg.len);
+            got += seg.len;
+        }
+        assert_int_equal(got, len - 1);
+        assert_int_equal(nextQueueSegment(q, &it, &seg), 0);
+
+        unsigned char exp[600];
+        assert_int_equal(tryDequeueBytes(q, exp, sizeof(exp)), len - 1);
+        assert_memory_equal(out, exp, len - 1);
+    }
+
+    // run node is byte and count
+    setQueueFlags(q, QUEUE_FLAG_RLE);
+    for (int i = 0; i < 100; i++)
+        enqueueByte(q, 5);
+    unsigned int runs = 0, total = 0;
+    for (it = QUEUE_SEGMENTS_BEGIN; nextQueueSegment(q, &it, &seg); total += seg.len)
+        if (seg.data == NULL)
+        {
+            assert_int_equal(seg.b, 5);
+            assert_int_equal(seg.spilled, 0);
+            runs++;
+        }
+    assert_int_equal(runs, 1);
+    assert_int_equal(total, 100);
+
+    destroyQueue(q);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_26(void **state) // bulk destroy and arena reset
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    // tests before may have left queues, drop them
+    unsigned int gen = resetArena();
+    queueArenaStats_t s;
+    getArenaStats(NULL, 0, &s);
+    assert_int_equal(s.free_nodes, 0);
+    assert_int_equal(s.bump_nodes, s.arena_nodes - 1);
+
+    for (int round = 0; round < 3; round++)
+    {
+        setArenaWatermarks(5, 20, onHighWatermark, onLowWatermark);
+        wm_low_calls = 0;
+
+        // plain, wide and run nodes left dirty by previous round
+        Q* q[10];
+        for (int i = 0; i < 10; i++)
+        {
+            q[i] = createQueue();
+            unsigned char b;
+            assert_int_equal(tryDequeue(q[i], &b), QUEUE_EMPTY);
+            if (i % 3 == 0)
+                setQueueFlags(q[i], QUEUE_FLAG_RLE);
+            int len = i == 9 ? 700 : i * 13;
+            for (int j = 0; j < len; j++)
+                enqueueByte(q[i], i % 3 == 0 ? i : j + round);
+        }
+        for (int i = 0; i < 10; i++)
+            for (int j = 0; j < (i == 9 ? 100 : i * 13); j++)
+                assert_int_equal(dequeueByte(q[i]), (unsigned char)(i % 3 == 0 ? i : j + round));
+
+        // chains are not walked, nothing goes to free list
+        destroyQueues(q, 10);
+        getArenaStats(NULL, 0, &s);
+        assert_int_equal(s.free_nodes, 0);
+        assert_int_equal(s.bump_nodes, s.arena_nodes - 1);
+        assert_int_equal(wm_low_calls, 1);
+        setArenaWatermarks(0, 255, NULL, NULL);
+    }
+
+    assert_int_equal(resetArena(), gen + 4);
+
+    // set not holding whole arena is destroyed queue by queue
+    Q* q[3];
+    for (int i = 0; i < 3; i++)
+    {
+        q[i] = createQueue();
+        for (int j = 0; j < 50; j++)
+            enqueueByte(q[i], j);
+    }
+    destroyQueues(q, 2);
+    getArenaStats(&q[2], 1, &s);
+    assert_int_equal(s.other_nodes, 0);
+    assert_true(s.free_nodes > 0);
+    for (int j = 0; j < 50; j++)
+        assert_int_equal(dequeueByte(q[2]), j);
+    destroyQueues(&q[2], 1);
+
+    // groups are left bound across reset, their levels get stale
+    queuePrioGroup_t g, g2;
+    initPrioGroup(&g);
+    initPrioGroup(&g2);
+    resetArena();
+    for (int i = 0; i < 2; i++)
+    {
+        q[i] = createQueue();
+        enqueueByte(q[i], i);
+        bindPrioQueue(&g, 3 + i, q[i]);
+    }
+    resetArena();
+
+    // new queues reuse both root indexes, as root and as data node
+    q[0] = createQueue();
+    for (int j = 0; j < 20; j++)
+        enqueueByte(q[0], j);
+    bindPrioQueue(&g2, 0, q[0]);
+    bindPrioQueue(&g, 3, NULL);
+
+    unsigned char b;
+    assert_int_equal(dequeueHighest(&g, &b), QUEUE_EMPTY);
+    for (int j = 0; j < 20; j++)
+    {
+        assert_int_equal(dequeueHighest(&g2, &b), 0);
+        assert_int_equal(b, j);
+    }
+    assert_int_equal(dequeueHighest(&g2, &b), QUEUE_EMPTY);
+    destroyQueue(q[0]);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_27(void **state) // lazy zeroing
+{
+    (void) state; // unused
+
+    resetErrors();
+
+    // garbage everywhere, init touches node 0 only
+    memset(buffer, 0xAA, BUFFER_LIMIT);
+    memset(segment_pool, 0x55, sizeof(segment_pool));
+    initQueues(buffer, 2 * QUEUE_SEGMENT_SIZE);
+    for (int i = sizeof(uint64_t); i < BUFFER_LIMIT; i++)
+        assert_int_equal(buffer[i], 0xAA);
+
+    setSegmentProvider(allocSegment, freeSegment);
+    segment_limit = SEGMENT_POOL;
+
+    // plain, wide and run nodes in buffer and in segments
+    for (int round = 0; round < 2; round++)
+    {
+        Q* q[8];
+        for (int i = 0; i < 8; i++)
+        {
+            q[i] = createQueue();
+            unsigned char b;
+            assert_int_equal(tryDequeue(q[i], &b), QUEUE_EMPTY);
+            if (i == 7)
+                setQueueFlags(q[i], QUEUE_FLAG_RLE);
+        }
+        for (int j = 0; j < 150; j++)
+            for (int i = 0; i < 8; i++)
+                assert_int_equal(tryEnqueue(q[i], i == 7 ? 3 : j + i), QUEUE_OK);
+        assert_true(segments_out > 0);
+        for (int j = 0; j < 150; j++)
+            for (int i = 0; i < 8; i++)
+                assert_int_equal(dequeueByte(q[i]), (unsigned char)(i == 7 ? 3 : j + i));
+
+        // second round runs on garbage left by first one
+        destroyQueues(q, 8);
+    }
+    setSegmentProvider(NULL, NULL);
+
+    // arena dropped with queues in it leaves shared nodes, wide
+    // chunks and group bindings in side tables
+    queuePrioGroup_t g;
+    initPrioGroup(&g);
+    for (int round = 0; round < 2; round++)
+    {
+        metrics = initQueues(buffer, BUFFER_LIMIT);
+        queueArenaStats_t s;
+        getArenaStats(NULL, 0, &s);
+        unsigned int idle = s.free_nodes + s.bump_nodes;
+
+        Q* a = createQueue();
+        Q* d = createQueue();
+        unsigned char b;
+        assert_int_equal(dequeueHighest(&g, &b), QUEUE_EMPTY);
+        bindPrioQueue(&g, 2, a);
+        bindPrioQueue(&g, 5, d);
+        for (int j = 0; j < 300; j++)
+            enqueueByte(a, j);
+        Q* c = cloneQueue(a);
+        enqueueByte(d, 7);
+
+        assert_int_equal(dequeueHighest(&g, &b), 2);
+        assert_int_equal(b, 0);
+        if (round == 0)
+            continue;
+
+        for (int j = 0; j < 300; j++)
+            assert_int_equal(dequeueByte(c), (unsigned char) j);
+
+        for (int j = 1; j < 300; j++)
+            assert_int_equal(dequeueByte(a), (unsigned char) j);
+        assert_int_equal(dequeueHighest(&g, &b), 5);
+        assert_int_equal(b, 7);
+        assert_int_equal(dequeueHighest(&g, &b), QUEUE_EMPTY);
+        destroyQueue(a);
+        destroyQueue(c);
+        destroyQueue(d);
+        getArenaStats(NULL, 0, &s);
+        assert_int_equal(s.free_nodes + s.bump_nodes, idle);
+    }
+
+    metrics = initQueues(buffer, BUFFER_LIMIT);
+
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
+static void test_28(void **state) // fd io
+{
+    (void) state; // unused
+
+    resetErrors();
+    metrics = initQueues(buffer, BUFFER_LIMIT);
+
+    int p[2], sp[2];
+    assert_int_equal(pipe(p), 0);
+    assert_int_equal(socketpair(AF_UNIX, SOCK_STREAM, 0, sp), 0);
+
+    unsigned char src[1200], dst[1200];
+    for (int i = 0; i < 1200; i++)
+        src[i] = i * 7 + i / 256;
+
+    queueArenaStats_t s;
+    getArenaStats(NULL, 0, &s);
+    unsigned int idle = s.free_nodes + s.bump_nodes;
+
+    // pipe -> queue, from empty through single and headtail to chain,
+    // in odd sized reads so every root/tail room state is hit
+    Q* q = createQueue();
+    assert_int_equal(write(p[1], src, 1200), 1200);
+    int got = 0;
+    for (int step = 1; got < 1200; step = step % 13 + 2)
+    {
+        int n = queueReadFromFd(q, p[0], step);
+        assert_true(n > 0 && n <= step);
+        got += n;
+    }
+    assert_int_equal(tryDequeueBytes(q, dst, 1200), 1200);
+    assert_memory_equal(src, dst, 1200);
+
+    // big read stops at iovecs it has, next one goes on
+    assert_int_equal(write(p[1], src, 1200), 1200);
+    int calls = 0;
+    for (got = 0; got < 1200; calls++)
+    {
+        int n = queueReadFromFd(q, p[0], 1200);
+        assert_true(n > 0);
+        got += n;
+    }
+    assert_true(calls > 1);
+    assert_int_equal(tryDequeueBytes(q, dst, 1200), 1200);
+    assert_memory_equal(src, dst, 1200);
+
+    // nothing to read: EAGAIN, queue and arena untouched
+    fcntl(p[0], F_SETFL, O_NONBLOCK);
+    tryEnqueueBytes(q, src, 3);
+    assert_int_equal(queueReadFromFd(q, p[0], 100), -1);
+    assert_int_equal(errno, EAGAIN);
+    assert_int_equal(tryDequeueBytes(q, dst, 100), 3);
+    getArenaStats(NULL, 0, &s);
+    assert_int_equal(s.free_nodes + s.bump_nodes, idle - 1);
+
+    // queue -> socket, plain, wide (long queue) and run data, bytes
+    // not taken stay in queue
+    Q* r = createQueue();
+    setQueueFlags(r, QUEUE_FLAG_RLE);
+    for (int i = 0; i < 600; i++)
+        tryEnqueue(r, i < 100 || i >= 500 ? src[i] : 9);
+    assert_int_equal(tryEnqueueBytes(q, src, 1000), 1000);
+
+    Q* both[2] = { q, r };
+    for (int k = 0; k < 2; k++)
+    {
+        unsigned int len = k == 0 ? 1000 : 600;
+        assert_int_equal(queueWriteToFd(both[k], sp[0], 2), 2);
+        assert_int_equal(queueWriteToFd(both[k], sp[0], 1), 1);
+        assert_int_equal(queueWriteToFd(both[k], sp[0], 100000), len - 3);
+        assert_int_equal(queueWriteToFd(both[k], sp[0], 100), 0);
+
+        for (unsigned int got = 0; got < len; )
+            got += read(sp[1], dst + got, len - got);
+        for (unsigned int i = 0; i < len; i++)
+            assert_int_equal(dst[i], k == 0 || i < 100 || i >= 500 ? src[i] : 9);
+    }
+
+    // run longer than staging space left ends writev, bytes after it
+    // come with next one
+    int w[2];
+    assert_int_equal(pipe(w), 0);
+    unsigned char want[616];
+    for (int i = 0; i < 616; i++)
+        want[i] = i < 13 ? src[i] : i < 613 ? 'a' : "XYZ"[i - 613];
+    for (int i = 0; i < 616; i++)
+        assert_int_equal(tryEnqueue(r, want[i]), QUEUE_OK);
+    for (unsigned int put = 0; put < 616; )
+    {
+        int n = queueWriteToFd(r, w[1], 100000);
+        assert_true(n > 0);
+        put += n;
+    }
+    assert_int_equal(read(w[0], dst, sizeof(dst)), 616);
+    assert_memory_equal(dst, want, 616);
+    close(w[0]);
+    close(w[1]);
+
+    // non-blocking socket fills up: partial write, then EAGAIN
+    fcntl(sp[0], F_SETFL, O_NONBLOCK);
+    int sz = 4096;
+    setsockopt(sp[0], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz));
+    unsigned int put = 0, out = 0, in = 0;
+    for (int round = 0; round < 1000 && (in < 20000 || put < in); round++)
+    {
+        for (int n = 1; in < 20000 && n != 0; in += n)
+            n = tryEnqueueBytes(q, src + in % 700, 700 - in % 700);
+        int n = queueWriteToFd(q, sp[0], 100000);
+        if (n < 0)
+            assert_int_equal(errno, EAGAIN);
+        else
+            put += n;
+
+        // peer drains some, checks order across partial writes
+        int m = read(sp[1], dst, sizeof(dst));
+        for (int i = 0; i < m; i++, out++)
+            assert_int_equal(dst[i], src[out % 700]);
+    }
+    assert_int_equal(put, in);
+    for (int m; out < put && (m = read(sp[1], dst, sizeof(dst))) > 0; )
+        for (int i = 0; i < m; i++, out++)
+            assert_int_equal(dst[i], src[out % 700]);
+    assert_int_equal(out, in);
+
+    // quota full: ENOBUFS, end of file: 0
+    setQueueQuota(r, 0, 1);
+    assert_int_equal(write(p[1], src, 20), 20);
+    assert_int_equal(queueReadFromFd(r, p[0], 100), 13);
+    assert_int_equal(queueReadFromFd(r, p[0], 100), -1);
+    assert_int_equal(errno, ENOBUFS);
+    assert_int_equal(queueWriteToFd(r, sp[0], 100), 13);
+    close(p[1]);
+    assert_int_equal(queueReadFromFd(r, p[0], 100), 7);
+    assert_int_equal(queueReadFromFd(r, p[0], 100), 0);
+    assert_int_equal(tryDequeueBytes(r, dst, 100), 7);
+    assert_memory_equal(dst, src + 13, 7);
+
+    // short read into queue holding reservation takes no node ahead:
+    // reservation stays whole, watermarks do not fire
+    Q* t = createQueue();
+    assert_int_equal(reserveCapacity(t, 100), QUEUE_OK);
+    getArenaStats(NULL, 0, &s);
+    unsigned int used = s.arena_nodes - 1 - s.free_nodes - s.bump_nodes;
+    wm_high_calls = wm_low_calls = 0;
+    setArenaWatermarks(used, used + 1, onHighWatermark, onLowWatermark);
+    for (int i = 0; i < 5; i++)
+    {
+        assert_int_equal(write(sp[1], src + i, 1), 1);
+        assert_int_equal(queueReadFromFd(t, sp[0], 1000), 1);
+    }
+    assert_int_equal(queueReadFromFd(t, sp[0], 1000), -1); // root is full
+    assert_int_equal(errno, EAGAIN);
+    assert_int_equal(queueReadFromFd(t, p[0], 1000), 0);
+    assert_int_equal(wm_high_calls + wm_low_calls, 0);
+    assert_int_equal(write(sp[1], src + 5, 1), 1);
+    assert_int_equal(queueReadFromFd(t, sp[0], 1000), 1);
+
+    Q* u = createQueue();
+    while (tryEnqueue(u, 1) == QUEUE_OK)
+        ;
+    for (int i = 6; i < 100; i++)
+        assert_int_equal(tryEnqueue(t, src[i]), QUEUE_OK);
+    assert_int_equal(tryDequeueBytes(t, dst, 200), 100);
+    assert_memory_equal(dst, src, 100);
+    setArenaWatermarks(0, 255, NULL, NULL);
+    destroyQueue(t);
+    destroyQueue(u);
+
+    destroyQueue(q);
+    destroyQueue(r);
+    close(p[0]);
+    close(sp[0]);
+    close(sp[1]);
+
+    getArenaStats(NULL, 0, &s);
+    assert_int_equal(s.free_nodes + s.bump_nodes, idle);
+    assert_int_equal(has_out_of_mem, 0);
+    assert_int_equal(has_illegal_op, 0);
+}
+
 static void perf_test_0()
 {
 
@@ -588,8 +2248,334 @@ static void perf_test_0()
     destroyQueue(q);
 }
 
+static double elapsed_ns(struct timespec* begin, struct timespec* end)
+{
+    return (end->tv_sec - begin->tv_sec) * 1e9 + (end->tv_nsec - begin->tv_nsec);
+}
+
+// L1d read miss counter of this thread, -1 if perf events are not available
+static int open_miss_counter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D
+                | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void perf_test_1() // u32 elements: byte api vs typed api
+{
+    const int N = 256;   // elements per round, 1 KiB
+    const int R = 2000;  // rounds
+    unsigned int s = 0;  // optimization killer
+
+    struct timespec begin, end;
+    Q* q = createQueue();
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int r = 0; r < R; r++)
+    {
+        for (uint32_t i = 0; i < (uint32_t)N; i++)
+            for (int j = 0; j < 4; j++)
+                enqueueByte(q, i >> (j * 8));
+        for (int i = 0; i < N; i++)
+        {
+            uint32_t v = 0;
+            for (int j = 0; j < 4; j++)
+                v |= (uint32_t)dequeueByte(q) << (j * 8);
+            s += v;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    double bytewise = elapsed_ns(&begin, &end) / (N * R);
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int r = 0; r < R; r++)
+    {
+        for (uint32_t i = 0; i < (uint32_t)N; i++)
+            tryEnqueueU32(q, i);
+        for (int i = 0; i < N; i++)
+        {
+            uint32_t v;
+            tryDequeueU32(q, &v);
+            s += v;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    double typed = elapsed_ns(&begin, &end) / (N * R);
+
+    printf("u32 push+pop per element: bytewise %.1f ns, typed %.1f ns\ns=%u\n",
+            bytewise, typed, s);
+
+    destroyQueue(q);
+}
+
+static void perf_test_2() // drain of queue built after churn, per policy
+{
+    const int LEN = 7 * 40;
+    const int R = 20000;
+    unsigned int s = 0; // optimization killer
+    const char* names[] = { "lifo", "near tail" };
+
+    for (int p = QUEUE_ALLOC_LIFO; p <= QUEUE_ALLOC_NEAR_TAIL; p++)
+    {
+        setAllocPolicy(p);
+        scatter_free_list();
+
+        Q* q = createQueue();
+        for (int i = 0; i < LEN; i++)
+            enqueueByte(q, i);
+        unsigned int crossings = queueLineCrossings(q);
+
+        // walk the same chain over and over: peek it by rotating
+        int fd = open_miss_counter();
+        struct timespec begin, end;
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+        for (int r = 0; r < R; r++)
+        {
+            unsigned char b = dequeueByte(q);
+            s += b;
+            enqueueByte(q, b);
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+        // crossings are locality proxy, counted on chain, not misses
+        printf("placement %s: %u line crossings in chain, rotate %.1f ns, ",
+                names[p], crossings, elapsed_ns(&begin, &end) / R);
+
+        uint64_t misses;
+        if (fd >= 0 && ioctl(fd, PERF_EVENT_IOC_DISABLE, 0) == 0
+                && read(fd, &misses, sizeof(misses)) == sizeof(misses))
+            printf("L1d misses %.3f per rotate\n", (double) misses / R);
+        else
+            printf("L1d misses n/a (no perf events)\n");
+        if (fd >= 0)
+            close(fd);
+        destroyQueue(q);
+    }
+    setAllocPolicy(QUEUE_ALLOC_NEAR_TAIL);
+
+    printf("s=%u\n", s);
+}
+
+static void perf_test_3() // spill and page in throughput
+{
+    const int LEN = 1 << 22;
+    static unsigned char chunk[1024];
+    unsigned int s = 0; // optimization killer
+
+    FILE* f = tmpfile();
+    setSpillFile(fileno(f));
+    Q* q = createQueue();
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int i = 0; i < LEN; i++)
+        enqueueByte(q, i);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    double spill = elapsed_ns(&begin, &end);
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int i = 0; i < LEN; i++)
+        s += dequeueByte(q);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    double refill = elapsed_ns(&begin, &end);
+
+    printf("spill byte api: enqueue %.0f MB/s, dequeue %.0f MB/s\n",
+            LEN * 1e3 / spill, LEN * 1e3 / refill);
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int i = 0; i < LEN; i += sizeof(chunk))
+        tryEnqueueBytes(q, chunk, sizeof(chunk));
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    spill = elapsed_ns(&begin, &end);
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int i = 0; i < LEN; i += sizeof(chunk))
+        s += tryDequeueBytes(q, chunk, sizeof(chunk));
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    refill = elapsed_ns(&begin, &end);
+
+    printf("spill bulk api: enqueue %.0f MB/s, dequeue %.0f MB/s\n",
+            LEN * 1e3 / spill, LEN * 1e3 / refill);
+
+    destroyQueue(q);
+    setSpillFile(-1);
+    fclose(f);
+
+    printf("s=%u\n", s);
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
+static void perf_test_4() // tight producer loops: called vs inlined byte api
+{
+#ifdef QUEUE_INLINE
+    const int Q_CNT = 8;  // queues fed round robin
+    const int N = 48;     // bytes per queue per round, plain nodes only
+    const int R = 20000;  // rounds
+    unsigned int s = 0;   // optimization killer
+
+    struct timespec begin, end;
+    Q* qs[Q_CNT];
+    for (int k = 0; k < Q_CNT; k++)
+        qs[k] = createQueue();
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int r = 0; r < R; r++)
+    {
+        for (int i = 0; i < N; i++)
+            for (int k = 0; k < Q_CNT; k++)
+                enqueueByte(qs[k], i + k);
+        for (int i = 0; i < N; i++)
+            for (int k = 0; k < Q_CNT; k++)
+                s += dequeueByte(qs[k]);
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    double called = elapsed_ns(&begin, &end) / (Q_CNT * N * R);
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int r = 0; r < R; r++)
+    {
+        for (int i = 0; i < N; i++)
+            for (int k = 0; k < Q_CNT; k++)
+                enqueueByteInline(qs[k], i + k);
+        for (int i = 0; i < N; i++)
+            for (int k = 0; k < Q_CNT; k++)
+                s += dequeueByteInline(qs[k]);
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    double inlined = elapsed_ns(&begin, &end) / (Q_CNT * N * R);
+
+    printf("byte push+pop: called %.1f ns, inlined %.1f ns\ns=%u\n", called, inlined, s);
+
+    for (int k = 0; k < Q_CNT; k++)
+        destroyQueue(qs[k]);
+#else
+    printf("byte push+pop: inlined api needs QUEUE_INLINE build (make inline)\n");
+#endif
+}
+
+// cycle counter for latency audit, ns where there is none
+static inline uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static unsigned int idle_nodes()
+{
+    queueArenaStats_t s;
+    getArenaStats(NULL, 0, &s);
+    return s.free_nodes + s.bump_nodes;
+}
+
+static int cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+static void perf_test_5() // worst case latency per state transition
+{
+    const int N = 100000; // samples per transition and allocator path
+
+    // queue is filled with fill bytes and drained by drain ones, then
+    // timed op does transition, changing idle nodes by delta
+    struct
+    {
+        const char* name;
+        int         fill;
+        int         drain;
+        int         enqueue; // 1 - timed op is enqueue, 0 - dequeue, -1 - createQueue
+        int         delta;
+    } tr[] = {
+        { "createQueue",                   0, 0, -1, -1 },
+        { "empty -> single",               0, 0,  1,  0 },
+        { "single full -> headtail, alloc", 5, 0,  1, -1 },
+        { "headtail -> chain, swap_tail",  13, 0,  1, -1 },
+        { "head exhausted, free_node",     21, 6,  0,  1 },
+        { "tail emptied, make_root_single", 6, 0,  0,  1 },
+    };
+
+    uint64_t* t = malloc(N * sizeof(uint64_t));
+    uint64_t overhead = UINT64_MAX;
+    for (int i = 0; i < 1000; i++)
+    {
+        uint64_t b = cycles();
+        uint64_t e = cycles();
+        if (e - b < overhead)
+            overhead = e - b;
+    }
+
+    printf("transition latency, cycles (timer overhead %lu taken out):\n", (unsigned long) overhead);
+    for (int from_free = 0; from_free < 2; from_free++)
+    {
+        for (unsigned int k = 0; k < sizeof(tr) / sizeof(tr[0]); k++)
+        {
+            int forced = 1;
+            for (int i = 0; i < N; i++)
+            {
+                initQueues(buffer, BUFFER_LIMIT);
+                if (from_free) // nodes to allocate are in free list, not in bump region
+                {
+                    Q* f = createQueue();
+                    for (int j = 0; j < 40; j++)
+                        enqueueByte(f, j);
+                    destroyQueue(f);
+                }
+
+                Q* q = tr[k].enqueue < 0 ? NULL : createQueue();
+                for (int j = 0; j < tr[k].fill; j++)
+                    enqueueByte(q, j);
+                for (int j = 0; j < tr[k].drain; j++)
+                    dequeueByte(q);
+
+                unsigned int idle = i == 0 ? idle_nodes() : 0;
+                uint64_t b = cycles();
+                if (tr[k].enqueue < 0)
+                    q = createQueue();
+                else if (tr[k].enqueue)
+                    enqueueByte(q, 1);
+                else
+                    dequeueByte(q);
+                uint64_t e = cycles();
+                t[i] = e - b > overhead ? e - b - overhead : 0;
+
+                if (i == 0)
+                    forced = idle_nodes() == idle + tr[k].delta;
+            }
+
+            qsort(t, N, sizeof(uint64_t), cmp_u64);
+            printf("  %-10s %-32s min %5lu  p99.99 %6lu  max %7lu%s\n", from_free ? "free list" : "bump",
+                   tr[k].name, (unsigned long) t[0], (unsigned long) t[N - 1 - N / 10000],
+                   (unsigned long) t[N - 1], forced ? "" : "  (transition not forced!)");
+        }
+    }
+
+    free(t);
+    metrics = initQueues(buffer, BUFFER_LIMIT);
+}
+
 int main(void)
 {
     srand(0);
@@ -598,6 +2584,11 @@ int main(void)
     setOutOfMemoryCallback(onOutOfMemory);
 
     perf_test_0();
+    perf_test_1();
+    perf_test_2();
+    perf_test_3();
+    perf_test_4();
+    perf_test_5();
 
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_6), // bad destroy bug test
@@ -609,6 +2600,32 @@ int main(void)
         cmocka_unit_test(test_0), // sanyty check after stress
         cmocka_unit_test(test_4), // limits stress
         cmocka_unit_test(test_0), // sanyty check after stress
+        cmocka_unit_test(test_7), // notifications
+        cmocka_unit_test(test_8), // try api
+        cmocka_unit_test(test_9), // quotas and watermarks
+        cmocka_unit_test(test_10), // typed api
+        cmocka_unit_test(test_11), // messages
+        cmocka_unit_test(test_12), // priority groups
+        cmocka_unit_test(test_13), // readiness set
+        cmocka_unit_test(test_14), // compaction
+        cmocka_unit_test(test_15), // node placement
+        cmocka_unit_test(test_16), // wide chunks
+        cmocka_unit_test(test_17), // run nodes
+        cmocka_unit_test(test_18), // spill tier
+        cmocka_unit_test(test_19), // segmented arena
+        cmocka_unit_test(test_20), // queue clones
+        cmocka_unit_test(test_21), // capacity reservation
+#ifdef QUEUE_INLINE
+        cmocka_unit_test(test_22), // inline byte api
+#endif
+#ifdef QUEUE_TRACE
+        cmocka_unit_test(test_23), // trace ring
+#endif
+        cmocka_unit_test(test_24), // arena stats
+        cmocka_unit_test(test_25), // segment walk
+        cmocka_unit_test(test_26), // bulk destroy and arena reset
+        cmocka_unit_test(test_27), // lazy zeroing
+        cmocka_unit_test(test_28), // fd io
         /* cmocka_unit_test(test_5), // random stress */
     };
 
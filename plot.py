@@ -1,8 +1,54 @@
 #!/bin/env python3
 
+import sys
 import numpy as np
 import matplotlib.pyplot as plt
 
+# queueTraceDump output (make trace): plot.py trace.bin
+if len(sys.argv) > 1:
+    header = np.dtype([('magic', 'S4'), ('version', '<u2'), ('event_size', '<u2'),
+                       ('count', '<u4'), ('lost', '<u4'),
+                       ('tsc_base', '<u8'), ('ns_base', '<u8'),
+                       ('tsc_dump', '<u8'), ('ns_dump', '<u8')])
+    event = np.dtype([('tsc', '<u8'), ('ticks', '<u4'), ('op', 'u1'),
+                      ('root', 'u1'), ('path', 'u1'), ('status', 'i1')])
+    ops = ['enq', 'deq', 'enq bulk', 'deq bulk']
+    paths = ['single', 'headtail', 'chain', 'alloc', 'free']
+
+    raw = open(sys.argv[1], 'rb').read()
+    h = np.frombuffer(raw, header, 1)[0]
+    assert h['magic'] == b'QTRC' and h['event_size'] == event.itemsize
+    e = np.frombuffer(raw, event, h['count'], header.itemsize)
+
+    # ticks to ns from clock pairs taken at init and at dump
+    ns_per_tick = (h['ns_dump'] - h['ns_base']) / max(int(h['tsc_dump'] - h['tsc_base']), 1)
+    lat = e['ticks'] * ns_per_tick
+    t = (e['tsc'] - h['tsc_base']) * ns_per_tick / 1e6
+    print("%d events, %d lost, %.3f ns/tick" % (h['count'], h['lost'], ns_per_tick))
+
+    fig, (hist, line) = plt.subplots(2, 1)
+    bins = np.logspace(0, np.log10(max(lat.max(), 10)), 80)
+    for i, name in enumerate(paths):
+        sel = e['path'] == i
+        if not sel.any():
+            continue
+        print("%-9s %8d  p50 %8.1f  p99 %8.1f  max %8.1f ns" %
+              (name, sel.sum(), *np.percentile(lat[sel], [50, 99, 100])))
+        hist.hist(lat[sel], bins, histtype='step', label=name)
+        line.plot(t[sel], lat[sel], '.', markersize=1, label=name)
+
+    hist.set_xscale('log')
+    hist.set_yscale('log')
+    hist.set_xlabel('ns')
+    hist.legend()
+    line.set_yscale('log')
+    line.set_xlabel('ms since initQueues')
+    line.set_ylabel('ns')
+    line.legend()
+    fig.suptitle(', '.join("%s %d" % (n, (e['op'] == i).sum()) for i, n in enumerate(ops)))
+    plt.show()
+    sys.exit()
+
 a = np.loadtxt("./bench_0.txt");
 
 fig = plt.figure()
@@ -28,6 +28,17 @@
 #include <memory.h>
 #include <limits.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#ifdef QUEUE_TRACE
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
 
 /*
 
@@ -72,7 +83,12 @@
 
 ## Performance
 
-    enqueueByte/dequeueByte/createQueue - worst case linear
+    enqueueByte/dequeueByte/createQueue - constant on transitions of plain
+    nodes (perf_test_5 times each of them, allocating from bump and from
+    free list), worst case linear on arena size, when wide chunk looks
+    for aligned room or queue is spilled; spilled data is paged in by
+    one pread of up to SPILL_BATCH nodes; full arena calls segment
+    provider
     destroyQueue is linear on element count in that queue
     printQueue is linear on element count in that queue
 
@@ -83,6 +99,9 @@
 
         [pfree|node|node|...|node]
 
+    Buffer may be smaller than 256 nodes and grow by segments, see
+    Segments below.
+
     Structure of node bit fields:
 
     Root node:
@@ -140,10 +159,34 @@
 ## Allocation/Deallocation:
 
     Generic node allocator with free nodes list implemented in free storage
-used. pfree index always points to free region that will be returned by
-allocate_node() call. deallocate() stores previous pfree value in free
-memory region to recover pfree after subsequent allocations/deallocations.
-Both functions work in constant time. Allocator returns zeroed out node.
+used. Node 0 (as_arena) keeps head of free list and bump index - first
+node never allocated so far, nodes from bump on are zeroed as bump
+hands them out (see below). Freed
+nodes are pushed to free list, which is doubly linked (as_free), so any
+node can be taken out of it in constant time. Allocator returns zeroed
+out node: from free list if any, from bump region otherwise.
+
+    Cache line (64 bytes) holds 8 nodes. free_lines has bit per node that
+is in free list, byte per line, so allocating node for queue can look for
+free slot in the line of queue's tail first (QUEUE_ALLOC_NEAR_TAIL policy),
+and chains of long queues stay on few lines instead of whatever node was
+freed last.
+
+    Nothing zeroes arena up front: bump region zeroes each node (chunk)
+as it hands it out, one store where it would be written anyway, so
+initQueues writes node 0 only, attached segments and room compactArena
+leaves are taken as they are, startup does not depend on arena size
+and pages are touched only when nodes get used.
+    Side tables go the same way: chunk_span and node_refs entries are
+zeroed as bump hands their node out, root_info entry as queue is
+created on its root, so only bitmaps (free_lines, ready_set) are reset
+up front. Group bindings in stale root_info entries are told apart by
+arena_gen, see Priority groups.
+    resetArena drops all queues by setting free list and bump back and
+clearing bitmaps, old nodes and side table entries are left as they
+are. destroyQueues takes this
+path when queues given hold every allocated node (sum of their root_info
+nodes is arena_used), so batch turnover walks no chains.
 
 
  Enqueue:
@@ -165,6 +208,265 @@ Both functions work in constant time. Allocator returns zeroed out node.
 
 
 
+## Wide chunks
+
+    Long queues get tail chunks of 4 or 8 nodes (32 or 64 bytes, aligned
+    to their size, so 8 node chunk is whole cache line) instead of plain
+    nodes: queue with 16 data nodes gets 4 node chunks, with 32 - 8 node
+    ones. Very long queues get extents: 16 node chunks from 64 nodes
+    on, 32 node ones (whole segment, 224 bytes streamed by one memcpy)
+    from 128, so queue holding most of arena is chain of few extents, not
+    of hundreds of nodes. Class is taken from queue's node count when new
+    tail is allocated, so as queue drains new tails go back down to
+    plain nodes. If no aligned room for chunk is found next smaller class
+    is tried, down to plain node, so chunks never make queue fail earlier.
+
+    Wide chunk:
+
+         [start][ end ][ data .................................. ][next]
+
+     start, end = offsets of first used and first free data byte
+     next       = index of next node, last byte of chunk
+
+    Chunk of N nodes holds N * 7 + 1 bytes as tail and N * 7 after
+    that (its last byte moves to new tail, as 8th byte of plain tail does),
+    exactly as N plain nodes would, so capacity figures and bulk node
+    estimates are same for any layout; spare bytes hold start/end.
+    Win is one allocation, one link and no shifting per 28 or 56 bytes.
+
+    Root marks wide head/tail with counter value WIDE_CNT (plain nodes
+    never have more than 8 bytes), so plain fast path has no extra
+    lookups; chunk_span side table gives size of chunk by its index.
+
+
+## Run nodes
+
+    Queue with QUEUE_FLAG_RLE turns its plain tail into run node when
+    tail is full of same byte and one more such byte comes: node keeps
+    byte and 16 bit count, so up to 65535 bytes take one node. Different
+    byte (or full count) starts new tail after it. Wide tail full of same
+    byte as its last 8 bytes gets run node as next tail. Bulk enqueue
+    extends runs with leading bytes of data, and makes new run node after
+    wide tail only if 7 or more same bytes follow. Run may be stored as
+    plain data for up to RUN_LEAD bytes (rest of tail, one new chunk, few
+    bytes to see the run) before it gets run node, so bulk estimate for
+    queue with runs (nodes_needed_rle) counts that much of each long run
+    as plain data and is still upper bound.
+
+    Run node:
+
+         XXXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX
+         [  b   ] [      ] [      count    ] [      ] [      ] [      ] [ next ]
+
+    Root marks run head/tail with counter value RUN_CNT, chunk_span of run
+    node is RUN_SPAN. Dequeue just decrements count, bulk dequeue memsets.
+    Flag is off by default, as runs make capacity depend on data.
+
+
+## Segments
+
+    Node index space is split in segments of 32 nodes (QUEUE_SEGMENT_SIZE
+    bytes, 4 cache lines, so aligned wide chunks never cross them): top 3
+    bits of index are segment, low 5 are node in it. initQueues buffer
+    holds first segments, the rest are attached on demand from segment
+    provider, when quota check finds arena short of nodes. Indices stay 8
+    bit, so node layout does not change; index_to_node has one predicted
+    branch for nodes outside of buffer. Bump region goes on into new
+    segment, which is zeroed lazily as buffer is. Only top segment can
+    be released, when all of its nodes are free: compactArena packs
+    nodes to low indices first, then releaseArenaSegments returns free
+    top segments.
+
+
+## Spill tier
+
+    With setSpillFile() arena is hot tier only: when queue can not get a
+    node, data nodes between its head and tail are appended to spill file
+    and replaced by one spill node, so root, head, tail and few paged in
+    nodes stay resident. Run nodes stay too, data between them gets spill
+    node per stretch. Next spill extends spill node before new data if
+    its data is still at end of file.
+
+    Spill node:
+
+         XXXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX XXXXXXXX
+         [            offset in file         ] [        length          ] [ next ]
+
+    Spill node is never tail. When head drains and next node is spill
+    node, up to SPILL_BATCH plain nodes are read back with one pread
+    (drained head is freed first, so at least one node is there) and
+    linked before it; first of them becomes head and takes partial
+    bytes, so the rest are full. If pread fails, spill node itself is
+    left as head with cnth 0 (is_spill_head) and data stays in file:
+    root keeps its 5 bytes, and dequeue that needs more retries page_in
+    and returns QUEUE_IO_ERROR on failure, bulk dequeue puts bytes back
+    into root to keep it full. File is append only, space of read back
+    or destroyed data is not reused until spill file is set again.
+
+
+## Clones
+
+    cloneQueue shares chain of queue instead of copying it: node_refs
+    side table counts queues holding node beyond first one. Shared node
+    is never written: queue whose head is shared reads it in place
+    (head counter SHARED_CNT, read offset and end in root_info) and
+    drops its reference when done, last queue frees node. Tail is never
+    shared, as enqueue writes it: clone gets copy of tail and own next
+    of node before it (link_from/link_to in root_info, taken by chain
+    walks instead of node's next byte), which is only link that may
+    differ between queues sharing node. Cloning clone copies nodes it
+    got after own link too, so each queue has one link at most.
+    Spilled data is not shared; compaction is off while nodes are
+    shared, as it would lay them out once per queue.
+
+
+## Errors
+
+    Core is written as enqueue_byte/dequeue_byte returning queueStatus_t,
+    failures are unlikely() branches returning status. Public enqueueByte
+    and dequeueByte only translate bad status to global callbacks, while
+    try* api passes status to caller as is, without any indirect calls.
+
+
+## Inline build
+
+    With QUEUE_INLINE queue.h has *Inline variants of byte api doing
+    plain root/head/tail case in caller (queueRoot_t is as_root seen
+    from outside, queueInlineBuf/Nodes mirror buffer), so tight loops
+    in other translation units do not pay a call per byte. Anything
+    that allocates, frees, flips readiness or is not plain node falls
+    back to out of line api, so library state stays same either way.
+
+
+## C++ api
+
+    queue.hpp wraps Q* into move only queue::ByteQueue, which is just
+    the pointer and forwards to try* api inline (to *Inline variants in
+    inline build), with std::span bulk calls; queue.h has extern "C"
+    guards for it. Its segments() walks nextQueueSegment, which gives
+    data of root, nodes and chunks in place - runs and spilled data
+    come as byte and count or as spilled count. test_hpp.cpp (make hpp)
+    tests it and times it against C api.
+
+## Trace
+
+    With QUEUE_TRACE every public byte/bulk call stores 16-byte event
+    (TSC at start, ticks taken, op, root, path) into static ring, which
+    overwrites oldest events and costs two rdtsc per call, no syscalls.
+    Path is root shape before call, unless call changed arena_used, then
+    it is alloc/free - so slow paths show up without hooks in core.
+    queueTraceDump writes header with TSC/ns pairs taken at init and at
+    dump (so reader can convert ticks to ns) and events oldest first,
+    plot.py decodes it.
+
+## Bulk and typed api
+
+    Bulk enqueue computes number of nodes needed from root state first
+    (nodes_needed), so whole record either fits or queue is untouched,
+    then copies payload sized chunks with memcpy: rest of root, rest of
+    tail, and 7 bytes per each new node (8th byte of full tail moves
+    to new tail, as in byte path).
+
+    Bulk dequeue takes root's 5 bytes, then chain bytes (take_chain),
+    then refills root from chain, root may end up single with less
+    than 5 bytes then.
+
+
+## Fd io
+
+    queueReadFromFd builds iovec of root/tail room and of new plain
+    nodes allocated ahead (near tail), each missing first byte, which
+    is where append_tail puts 8th byte of previous full tail. Nodes are
+    taken for what FIONREAD says fd has (FD_BATCH of them if fd can not
+    tell), so they are left over only if read races with consumer of
+    fd; if fd has nothing and there is no room, byte that may come is
+    read to stack, so EOF or EAGAIN takes no node. After readv nodes
+    reached are linked in order with append_tail, rest go back to free
+    list and to reserveCapacity of queue.
+    queueWriteToFd points iovec at root, head and chain bytes in place
+    (runs are copied to small stack buffer), then drops bytes fd took
+    with dequeue_bytes(NULL), which skips copy out and only moves rest
+    of partial head. Writev stops before spill node, and so that root
+    refill never reads spilled data either, at bytes in memory before
+    it; spilled data is paged in by dequeue after that.
+
+
+## Messages
+
+    Message is LEB128 varint length (1-5 bytes) followed by payload,
+    both written by single bulk enqueue after space check for whole
+    message. Length is read with peek_bytes from root and first nodes,
+    so payload is never scanned to find boundaries.
+
+
+## Compaction
+
+    compactArena rebuilds arena from a stack copy of it: every queue's root
+    followed by its chain in FIFO order, so free nodes become one bump
+    region after them and free list is empty. Wide chunks are packed into
+    whole lines right after line 0, or after segment 0 if there are
+    extents (largest first, so smaller ones stay aligned); plain nodes
+    fill room before them and go after wide region, if there are too few
+    of them rest of that room is put to free list. If alignment wasted
+    room so that layout does not fit arena, nothing is moved. Roots move
+    too, so caller passes all live handles (their node count has to be
+    arena_used, checked before anything moves) and gets new ones back;
+    root_info, ready_set bits and priority group handles move with roots.
+
+
+## Readiness set
+
+    ready_set has bit per root index, set while queue is non-empty. Bits
+    are flipped on same transitions as priority groups, so dispatcher
+    finds non-empty queues by scanning 4 words with ctz instead of probing
+    every root, and pollReadyQueue keeps round robin cursor over them.
+
+
+## Priority groups
+
+    Group has bit per level set while level's queue is non-empty,
+    bits are flipped by on_queue_ready/on_queue_empty, i.e. only on
+    empty <-> non-empty transitions of root. dequeueHighest takes
+    lowest set bit with ctz, so it does not depend on level count.
+    resetArena does not touch groups (they may be gone, as queues are
+    not unbound) nor root_info, it starts new arena_gen. So level
+    whose root_info does not point back to it in current generation
+    holds stale handle: unbinding it leaves queue now at that root
+    index alone, and dequeueHighest drops it.
+
+
+## Quotas and watermarks
+
+    Queue may have quota_min nodes reserved and quota_max limit of data
+    nodes (root not counted). arena_reserved holds number of reserved nodes
+    not yet taken by their queues, all other allocations must leave that
+    many nodes free. Accounting is done on node alloc/free only, which is
+    once per 7 bytes, so byte fast path is not affected. Part of quota_min
+    queue holds now is kept in qresv: it grows back only by nodes free
+    really gives to arena, so dropping node clone still holds does not
+    reserve node that is not free (arena_reserved never exceeds free).
+
+    reserveCapacity claims nodes for next bytes of queue (worst case of
+    any content from its current state, nodes_needed_any: last chunk
+    taking one byte, run node after each full wide chunk; beyond what
+    quota_min holds for it) the same way: they are counted in arena_reserved and in resv of queue,
+    which node allocs take first, so enqueues within it skip arena
+    check and can not fail halfway through frame.
+
+    Watermarks are checked for equality with arena_used on each alloc and
+    free (it moves by 1), hooks fire with hysteresis: high once when going
+    up, low once when going down after high fired.
+
+
+## Notifications
+
+    Root side info (notifier etc) lives in root_info table outside of
+    buffer, indexed same as root node. It is touched only on empty <->
+    non-empty transitions, so normal enqueue/dequeue never reads it.
+    Notifier is signalled only if it is not pending, consumer re-arms it
+    with ackQueueNotifier - that coalesces bursts into single write().
+
+
 List as FIFO semantic:
 
       Oueue:
@@ -184,7 +486,8 @@ List as FIFO semantic:
 #define TAIL_PAYLOAD 8
 
 // 64 bit bit-filed node struct to access data and indexes, unioned so same
-// node_t can be seen: as_root, as_node, as_tail and as_pfree.
+// node_t can be seen: as_root, as_node, as_tail, as_free and as_pfree;
+// node 0 is seen as_arena.
 typedef union
 {
     struct
@@ -204,6 +507,36 @@ typedef union
         unsigned char  cnth : 4 ;
         unsigned char  cntt : 4 ;
     } as_root;
+    struct
+    {
+        unsigned char  b;     // byte of run
+        unsigned char  unused;
+        unsigned short cnt;   // number of bytes in run
+        unsigned char  pad[3];
+        unsigned char  next;
+    } as_run;
+    struct
+    {
+        unsigned int   off;    // offset of data in spill file
+        unsigned char  len[3]; // number of bytes, little endian
+        unsigned char  next;
+    } as_spill;
+    struct
+    {
+        unsigned char  start; // offset of first data byte in chunk
+        unsigned char  end;   // offset of first free byte in chunk
+        unsigned char  data[6];
+    } as_wide;
+    struct
+    {
+        unsigned int   free; // head of free list, 0 - empty
+        unsigned int   bump; // first never allocated node
+    } as_arena;
+    struct
+    {
+        unsigned int   next; // next free node, 0 - end of list
+        unsigned int   prev; // previous free node, 0 - list head
+    } as_free;
     unsigned long int as_pfree;
     unsigned int      as_ints[2];
 } __attribute__((packed)) node_t;
@@ -216,11 +549,51 @@ static_assert(sizeof(char) == 1,              "In case C standard violated by co
 static_assert(CHAR_BIT == 8,                  "In case platform is weird");
 
 #define NODE_COUNT 256
+#define LINE_NODES 8 // nodes per 64 byte cache line
+
+#define WIDE_HDR 2   // start and end offsets of wide chunk
+#define WIDE_CNT 15  // head/tail counter of wide head/tail, fill is in chunk
+#define WIDE_MIN 4   // nodes in smallest wide chunk
+#define WIDE_MAX 8   // nodes in wide chunk of whole cache line
+#define WIDE_EXT 32  // nodes in largest extent, whole segment
+
+#define RUN_CNT  14     // head/tail counter of run node, count is in node
+#define RUN_SPAN 1      // chunk_span of run node
+#define RUN_MAX  0xFFFF // max bytes in run node
+#define RUN_LEAD 128    // max bytes of run stored as plain data before run node
+
+#define SPILL_SPAN    2        // chunk_span of spill node
+#define SPILL_LEN_MAX 0xFFFFFF // max bytes behind one spill node
+#define SPILL_BATCH   32       // max nodes paged in at once
+
+#define SHARED_CNT 13 // head counter of shared head, cursor is in root_info
+
+// Branch hints, error paths are kept out of hot code
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
 
 // Static buffer for data - can be set from outside
-// with initQueues() call, and its len. No other data used.
-static node_t* buffer;
-static int     buffer_len;
+// with initQueues() call, and its len in nodes.
+static node_t*      buffer;
+static unsigned int buffer_nodes;
+
+#ifdef QUEUE_INLINE
+// Same for inline fast path in queue.h, which sees root as queueRoot_t
+unsigned char* queueInlineBuf;
+unsigned int   queueInlineNodes;
+
+static_assert(sizeof(queueRoot_t) == sizeof(node_t), "Inline root is a node");
+static_assert(offsetof(queueRoot_t, head) == offsetof(node_t, as_root.head), "Inline root layout");
+static_assert(offsetof(queueRoot_t, tail) == offsetof(node_t, as_root.tail), "Inline root layout");
+#endif
+
+// Segments of arena by index / SEG_NODES, first ones are in buffer;
+// nodes attached, multiple of SEG_NODES
+#define SEG_NODES (QUEUE_SEGMENT_SIZE / sizeof(node_t))
+static node_t*      seg_base[NODE_COUNT / SEG_NODES];
+static unsigned int arena_nodes;
+static queueSegmentAlloc_cb_t onSegmentAlloc;
+static queueSegmentFree_cb_t  onSegmentFree;
 
 
 // Callbacks
@@ -228,14 +601,90 @@ static onOutOfMem_cb_t onOutOfMemory;
 static onIllegalOperation_cb_t onIllegalOperation;
 
 
+// Per-queue data used on rare paths, indexed by root node index
+typedef struct
+{
+    queueNotifier_t*  notifier;
+    queuePrioGroup_t* group;     // priority group queue is bound to
+    unsigned char     level;     // level of queue in group
+    unsigned char     nodes;     // number of data nodes, root not included
+    unsigned char     quota_min; // nodes reserved for queue
+    unsigned char     quota_max; // max data nodes, 0 - no limit
+    unsigned char     qresv;     // nodes of quota_min reserved now, up to quota_min - nodes
+    unsigned char     resv;      // nodes reserved by reserveCapacity, beyond quota_min
+    unsigned char     flags;     // QUEUE_FLAG_*
+    unsigned char     link_from; // last shared node whose next is link_to
+    unsigned char     link_to;   // for this clone, 0 - none
+    unsigned short    head_pos;  // bytes of shared head read so far,
+    unsigned short    head_end;  // offsets in node, counts for run node
+    unsigned int      gen;       // arena_gen group was bound in
+} root_info_t;
+
+static root_info_t root_info[NODE_COUNT];
+
+
+// Bit per node in free list, byte per cache line
+static unsigned char free_lines[NODE_COUNT / LINE_NODES];
+
+// Number of nodes in wide chunk starting at index,
+// RUN_SPAN - run node, SPILL_SPAN - spill node, 0 - plain node
+static unsigned char chunk_span[NODE_COUNT];
+static queueAllocPolicy_t alloc_policy = QUEUE_ALLOC_NEAR_TAIL;
+
+// Number of queues sharing node beyond first one, number of nodes
+// shared and of clones with own link after shared node
+static unsigned char node_refs[NODE_COUNT];
+static unsigned int  shared_nodes;
+static unsigned int  clone_links;
+
+// Spill file, -1 - spilling is off; offset where next spill goes
+static int   spill_fd = -1;
+static off_t spill_end;
+
+// Set of non-empty queues, bit per root node index
+static uint64_t ready_set[NODE_COUNT / 64];
+
+// Arena accounting: allocated nodes and nodes reserved by quota_min
+// (qresv) and reserveCapacity of queues but not allocated by them yet
+static unsigned int arena_used;
+static unsigned int arena_reserved;
+
+// Number of resetArena and initQueues calls done
+static unsigned int arena_gen;
+
+// Watermarks on arena_used, high fires once when reached,
+// low fires once when reached after high fired
+static unsigned int wm_low;
+static unsigned int wm_high;
+static bool         wm_above;
+static onWatermark_cb_t onHighWatermark;
+static onWatermark_cb_t onLowWatermark;
+
+#ifdef QUEUE_TRACE
+// Trace ring, event n is at n % QUEUE_TRACE_SIZE; clock pair taken
+// by initQueues
+static_assert((QUEUE_TRACE_SIZE & (QUEUE_TRACE_SIZE - 1)) == 0, "Trace ring is power of 2");
+static queueTraceEvent_t trace_ring[QUEUE_TRACE_SIZE];
+static uint64_t          trace_cnt;
+static uint64_t          trace_tsc_base;
+static uint64_t          trace_ns_base;
+#endif
+
+
 // ========================================================================== //
 
-// helper, returns true if pointer is withit [buffer, buffer + MA
+// helper, returns true if pointer is node of arena, not header
 static inline bool bounds_check(node_t* node);
 
+// index of node searched in all segments, 0 if not found
+static unsigned int find_node_index(node_t* node);
+
 // Get queue root
 static inline node_t* get_queue_root(Q* q);
 
+// Get queue handle of root, goes through void* as root is packed
+static inline Q* get_queue_handle(node_t* root);
+
 // get node's index
 static inline unsigned char node_to_index(node_t* node);
 
@@ -306,19 +755,321 @@ static inline void make_root_single(node_t* root);
 
 
 
-// gettters/setters for node's next node
+// gettters/setters for node's next node, next index is last
+// byte of node or wide chunk
 
 static inline node_t* get_node_next(node_t* node);
 static inline void set_node_next(node_t* node, node_t* next);
 
 
 
-// Allocates a node, returns it all zeroed
-static node_t* alloc_node();
+// Wide chunks
+
+// number of nodes in node's chunk, 1 for plain node
+static inline unsigned int node_span(node_t* node);
+
+// checks if root has wide head/tail, i.e. counter is WIDE_CNT
+static inline bool is_wide_head(node_t* root);
+static inline bool is_wide_tail(node_t* root);
+
+// bytes chunk of span nodes holds as tail, same as span plain nodes
+static inline unsigned int wide_cap(unsigned int span);
+
+// number of bytes in wide chunk
+static inline unsigned int wide_fill(node_t* chunk);
+
+// moves data of wide chunk to its start, so tail can take its
+// wide_cap() bytes even if it was dequeued from as head
+static inline void compact_wide(node_t* chunk);
+
+// counter value for root head set to node
+static inline unsigned char head_cnt(node_t* node);
+
+// chunk class (nodes in chunk) for next tail of queue
+static inline unsigned int chunk_class(node_t* root);
+
+// same for queue of given number of data nodes
+static inline unsigned int nodes_class(unsigned int nodes);
+
+// largest class not above span that len bytes fill completely
+static inline unsigned int fit_class(unsigned int span, unsigned int len);
+
+// links new chunk after full tail, last byte of old tail moves to new
+// one, as 8th byte of full plain tail does
+static inline void append_tail(node_t* root, node_t* newtail);
+
+// adds byte to tail that has room, plain or wide
+static inline void push_tail_byte(node_t* root, unsigned char b);
+
+// byte path for queues with wide tail/head
+static inline queueStatus_t enqueue_wide(node_t* root, unsigned char b);
+static inline queueStatus_t dequeue_wide(node_t* root, unsigned char* b);
+
+// number of bytes in chain node p of root and pointer to them,
+// pointer is NULL for run and spill node
+static inline unsigned int chunk_bytes(node_t* root, node_t* p, unsigned char** data);
+
+// counter value for root tail set to new node
+static inline unsigned char tail_cnt(node_t* node);
+
+// removes drained head node, makes root single if it was tail too,
+// pages spilled data in if it is next, next node shared with other
+// queues becomes shared head
+static inline void drop_head(node_t* root, node_t* head);
+
+
+
+// Run nodes
+
+// checks if root has run head/tail, i.e. counter is RUN_CNT
+static inline bool is_run_head(node_t* root);
+static inline bool is_run_tail(node_t* root);
+
+// checks if queue has QUEUE_FLAG_RLE
+static inline bool rle_enabled(node_t* root);
+
+// checks if full tail ends with 8 bytes equal to b
+static inline bool tail_ends_with_run(node_t* root, unsigned char b);
+
+// turns new node into empty run of byte b
+static inline void init_run(node_t* node, unsigned char b);
+
+// turns full plain tail of same bytes into run node in place
+static inline void make_run_tail(node_t* root);
+
+// number of leading bytes of src equal to b, up to max
+static inline unsigned int run_length(const unsigned char* src, unsigned int len,
+                                      unsigned char b, unsigned int max);
+
+// byte path for queues with run tail/head
+static inline queueStatus_t enqueue_run(node_t* root, unsigned char b);
+static inline queueStatus_t dequeue_run(node_t* root, unsigned char* b);
+
+
+
+// Spill tier
 
-// Deallocates node, should not be used after free
+// checks if node is spill node
+static inline bool is_spill(node_t* node);
+
+// number of spilled bytes behind spill node
+static inline unsigned int spill_len(node_t* node);
+static inline void set_spill_len(node_t* node, unsigned int len);
+
+// writes/reads len bytes at offset of spill file, false on I/O error
+static bool spill_write(const unsigned char* src, unsigned int len, off_t at);
+static bool spill_read(unsigned char* dst, unsigned int len, off_t at);
+
+// moves data nodes between prev and end to spill file, replacing them
+// by spill node or adding them to prev if it is spill node ending at end
+// of file; returns false if it would not free any node
+static bool spill_stretch(node_t* root, node_t* prev, node_t* end);
+
+// spills all data nodes between head and tail of queue, except run
+// nodes, returns false if it did not free any node
+static bool spill_queue(node_t* root);
+
+// replaces drained head by nodes read back from spill node after it,
+// returns false if read fails, spill node is left as empty head then
+static bool page_in(node_t* root, node_t* head, node_t* spill);
+
+// true if head is spill node left by failed page_in
+static inline bool is_spill_head(node_t* root);
+
+
+
+// Clones
+
+// checks if root reads shared head in place, i.e. counter is SHARED_CNT
+static inline bool is_shared_head(node_t* root);
+
+// next node in queue's chain, clone may have own next of last shared node
+static inline node_t* chain_next(node_t* root, node_t* node);
+
+// checks if node's next may not change: it is shared or it is last
+// shared node of clone
+static inline bool is_pinned(node_t* root, node_t* node);
+
+// drops one reference of shared node, false if node is not shared
+static inline bool unref_node(node_t* node);
+
+// sets head that is read in place; plain head holds cnt bytes
+static void share_head(node_t* root, node_t* head, unsigned int cnt);
+
+// byte path for queues with shared head
+static inline queueStatus_t dequeue_shared(node_t* root, unsigned char* b);
+
+
+
+// Trace
+
+#ifdef QUEUE_TRACE
+// TSC, or ns where there is none
+static inline uint64_t trace_clock();
+static uint64_t trace_ns();
+
+// QUEUE_TRACE_* shape of root
+static inline unsigned int trace_path(node_t* root);
+
+// records event of call started at t0 with arena_used used
+static inline void trace_event(node_t* root, unsigned int op, uint64_t t0,
+                               unsigned int used, unsigned int path, int status);
+
+// public api wraps its call into these, they are empty without QUEUE_TRACE
+#define TRACE_BEGIN(root)                        \
+    uint64_t     trace_t0 = trace_clock();       \
+    unsigned int trace_used = arena_used;        \
+    unsigned int trace_shape = trace_path(root)
+#define TRACE_END(root, op, status) \
+    trace_event(root, op, trace_t0, trace_used, trace_shape, status)
+#else
+#define TRACE_BEGIN(root)
+#define TRACE_END(root, op, status)
+#endif
+
+
+// Arena stats
+
+// adds nodes, bytes and slots of queue to s, marks its nodes in seen;
+// returns number of nodes not seen before
+static unsigned int usage_walk(node_t* root, queueArenaStats_t* s, uint64_t* seen);
+
+
+
+// Allocates a node, returns it all zeroed, or NULL
+// if out of memory - callers decide how to report it;
+// if near is not NULL node in same cache line is preferred
+static node_t* alloc_node(node_t* near);
+
+// Allocates wide chunk of span nodes aligned to span,
+// returns NULL if there is no such free room
+static node_t* alloc_wide(unsigned int span);
+
+// Deallocates node or wide chunk, should not be used after free
 static void free_node(node_t* node);
 
+// Puts node to free list, no accounting
+static inline void push_free(unsigned int idx);
+
+// Takes node out of free list
+static inline void unlink_free(unsigned int idx);
+
+// Moves arena_used by delta, calls watermark hooks if crossed
+static inline void account_nodes(int delta);
+
+// Returns free list node in same cache line as node at, 0 if none
+static inline unsigned int free_slot_near(unsigned int at);
+
+
+// Allocates data node or wide chunk of span nodes for queue with
+// respect to its quota and reservations of other queues, returns NULL
+// if not possible; near is node new one will be linked to
+static inline node_t* alloc_queue_node(node_t* root, node_t* near, unsigned int span);
+
+// Allocates new tail of span nodes, smaller one if it fails,
+// spills middle of queue to get it if arena is exhausted
+static inline node_t* alloc_tail_chunk(node_t* root, node_t* tail, unsigned int span);
+
+// Frees queue's data node, returning it to queue's reservation if any
+static inline void free_queue_node(node_t* root, node_t* node);
+
+// Status to report when alloc_queue_node failed
+static queueStatus_t alloc_failure(node_t* root);
+
+// Number of nodes not allocated
+static inline unsigned int arena_free();
+
+// Attaches segments from provider until cnt nodes are free and not
+// reserved, returns false if provider can not give them
+static bool grow_arena(unsigned int cnt);
+
+// Calls watermark hooks when arena_used hits watermarks
+static void check_watermarks();
+
+
+// called when queue goes from empty to non-empty state
+static void on_queue_ready(node_t* root);
+
+// called when queue goes from non-empty to empty state
+static void on_queue_empty(node_t* root);
+
+// returns index of first non-empty root at or after from, or 0 if none
+static inline unsigned int find_ready(unsigned int from);
+
+// true if level of group holds queue bound to it, not handle left
+// from before resetArena whose root index now has other queue
+static inline bool is_bound_level(queuePrioGroup_t* g, unsigned int level);
+
+
+
+// Bulk helpers
+
+// number of nodes enqueue of len bytes will allocate
+static inline unsigned int nodes_needed(node_t* root, unsigned int len);
+
+// same for queue with runs, after plain bytes of some other data:
+// upper bound counting RUN_LEAD bytes of each long run as plain data
+// and one run node per RUN_MAX bytes of rest of it
+static unsigned int nodes_needed_rle(node_t* root, unsigned int plain,
+                                     const unsigned char* src, unsigned int len);
+
+// upper bound for len bytes of any content, enqueued byte by byte
+// or in bulk in any split: last chunk may take one byte only, and
+// full wide tail ending with run gets run node for one byte
+static unsigned int nodes_needed_any(node_t* root, unsigned int len);
+
+// checks if queue can allocate cnt nodes with respect to quotas
+static inline queueStatus_t check_queue_nodes(node_t* root, unsigned int cnt);
+
+// same, spills middle of queue if that makes room
+static inline queueStatus_t make_room(node_t* root, unsigned int cnt);
+
+// checks if queue has at least len bytes, walks len / 7 nodes max
+static inline bool queue_has_bytes(node_t* root, unsigned int len);
+
+// moves up to len bytes from chain (head..tail, not root) to dst,
+// frees emptied nodes, makes root single if whole chain is taken,
+// root counter is left for caller to set then; NULL dst drops them
+static unsigned int take_chain(node_t* root, unsigned char* dst, unsigned int len);
+
+// enqueues all len bytes or nothing, copies node payload sized chunks
+static inline queueStatus_t enqueue_bytes(node_t* root, const unsigned char* src, unsigned int len);
+
+// appends len bytes after space for them is checked, returns bytes
+// appended, less than len only if node allocation still failed
+static unsigned int append_bytes(node_t* root, const unsigned char* src, unsigned int len);
+
+// dequeues up to len bytes, returns number of bytes dequeued,
+// NULL dst drops them (already written out by writev)
+static inline unsigned int dequeue_bytes(node_t* root, unsigned char* dst, unsigned int len);
+
+// copies up to len bytes from front of queue without dequeuing them
+static unsigned int peek_bytes(node_t* root, unsigned char* dst, unsigned int len);
+
+
+// Fd io, iovecs point into nodes
+
+#define FD_IOV  64  // iovecs per readv/writev, 7 bytes of plain node each
+#define FD_FILL 512 // stack bytes writev copies runs and spilled data to
+#define FD_BATCH 8  // nodes read takes ahead if fd can not tell what it has
+
+// fills iov with up to max front bytes of non-empty queue in place,
+// run and spilled ones copied to fill; returns bytes, *cnt - iovecs
+static unsigned int gather_iov(node_t* root, struct iovec* iov, unsigned int* cnt,
+                               unsigned char* fill, unsigned int max);
+
+
+// Message framing, length is stored as LEB128 varint before payload
+
+#define MSG_HEADER_MAX 5
+
+// encodes len to hdr, returns number of header bytes
+static inline unsigned int encode_msg_len(unsigned char* hdr, unsigned int len);
+
+// decodes header of message at front of queue, returns number
+// of header bytes or 0 if there is no (complete) header
+static inline unsigned int decode_msg_len(node_t* root, unsigned int* len);
+
 
 // ========================================================================== //
 
@@ -332,20 +1083,42 @@ static inline node_t* get_queue_root(Q* q)
     return root;
 }
 
+static inline Q* get_queue_handle(node_t* root)
+{
+    void* q = root;
+    return q;
+}
+
 static inline bool bounds_check(node_t* node)
 {
-    return (node != NULL) && (buffer < node && node < buffer + NODE_COUNT);
+    return (node != NULL) && find_node_index(node) != 0;
+}
+
+static unsigned int __attribute__((noinline)) find_node_index(node_t* node)
+{
+    for (unsigned int s = 0; s < arena_nodes / SEG_NODES; s++)
+    {
+        uintptr_t off = (uintptr_t) node - (uintptr_t) index_to_node(s * SEG_NODES);
+        if (off < QUEUE_SEGMENT_SIZE)
+            return s * SEG_NODES + off / sizeof(node_t);
+    }
+    return 0;
 }
 
 static inline unsigned char node_to_index(node_t* node)
 {
     assert(bounds_check(node));
-    return node - buffer;
+    uintptr_t idx = ((uintptr_t) node - (uintptr_t) buffer) / sizeof(node_t);
+    if (likely(idx < buffer_nodes))
+        return idx;
+    return find_node_index(node);
 }
 
 static inline node_t* index_to_node(unsigned char index)
 {
-    return buffer + index;
+    if (likely(index < buffer_nodes))
+        return buffer + index;
+    return seg_base[index / SEG_NODES] + index % SEG_NODES;
 }
 
 
@@ -423,7 +1196,7 @@ static inline void set_root_head(node_t* root, node_t* head, unsigned char cnt)
 {
     assert(bounds_check(root));
     assert(bounds_check(head));
-    assert(cnt <= NODE_PAYLOAD);
+    assert(cnt <= NODE_PAYLOAD || cnt == WIDE_CNT || cnt == RUN_CNT || cnt == SHARED_CNT);
     root->as_root.head = node_to_index(head);
     root->as_root.cnth = cnt;
 }
@@ -432,7 +1205,7 @@ static inline void set_root_tail(node_t* root, node_t* tail, unsigned char cnt)
 {
     assert(bounds_check(root));
     assert(bounds_check(tail));
-    assert(cnt <= TAIL_PAYLOAD);
+    assert(cnt <= TAIL_PAYLOAD || cnt == WIDE_CNT || cnt == RUN_CNT);
     root->as_root.tail = node_to_index(tail);
     root->as_root.cntt = cnt;
 }
@@ -614,199 +1387,2476 @@ static inline void make_root_single(node_t* root)
 static inline node_t* get_node_next(node_t* node)
 {
     assert(bounds_check(node));
-    return  index_to_node(node->as_node.next);
+    unsigned char* d = (unsigned char*) node;
+    return  index_to_node(d[node_span(node) * sizeof(node_t) - 1]);
 }
 
 static inline void set_node_next(node_t* node, node_t* next)
 {
     assert(bounds_check(node));
     assert(bounds_check(next));
-    node->as_node.next = node_to_index(next);
+    unsigned char* d = (unsigned char*) node;
+    d[node_span(node) * sizeof(node_t) - 1] = node_to_index(next);
 }
 
+// Wide chunks
 
-// ========================================================================== //
+static inline unsigned int node_span(node_t* node)
+{
+    unsigned int span = chunk_span[node_to_index(node)];
+    return span > SPILL_SPAN ? span : 1; // run and spill nodes are plain sized
+}
 
-static node_t* alloc_node()
+static inline bool is_wide_head(node_t* root)
 {
+    assert(!is_single_root(root));
+    return root->as_root.cnth == WIDE_CNT;
+}
 
-    assert(buffer->as_pfree != 0);
+static inline bool is_wide_tail(node_t* root)
+{
+    // single root never has more than ROOT_PAYLOAD
+    return root->as_root.cntt == WIDE_CNT;
+}
 
-    if (buffer->as_pfree >= NODE_COUNT)
-    {
-        onOutOfMemory();
-        return NULL;
-    }
+static inline unsigned int wide_cap(unsigned int span)
+{
+    return span * NODE_PAYLOAD + 1;
+}
 
-    node_t* ret = index_to_node(buffer->as_pfree);
+static inline unsigned int wide_fill(node_t* chunk)
+{
+    return chunk->as_wide.end - chunk->as_wide.start;
+}
 
-    if (ret->as_pfree == 0)
-    {
-        buffer->as_pfree += 1;
-    }
-    else
-    {
-        buffer->as_pfree = ret->as_pfree;
-        ret->as_pfree = 0;
-    }
+static inline void compact_wide(node_t* chunk)
+{
+    unsigned char* d = (unsigned char*) chunk;
+    unsigned int fill = wide_fill(chunk);
 
-    return ret;
+    memmove(d + WIDE_HDR, d + chunk->as_wide.start, fill);
+    chunk->as_wide.start = WIDE_HDR;
+    chunk->as_wide.end = WIDE_HDR + fill;
 }
 
-static void free_node(node_t* node)
+static inline unsigned char head_cnt(node_t* node)
 {
-    assert(bounds_check(node));
+    unsigned int span = chunk_span[node_to_index(node)];
+    return span == 0 ? NODE_PAYLOAD : span == RUN_SPAN ? RUN_CNT : WIDE_CNT;
+}
 
-    node->as_pfree = buffer->as_pfree;
-    buffer->as_pfree = node_to_index(node);
+static inline unsigned char tail_cnt(node_t* node)
+{
+    unsigned int span = chunk_span[node_to_index(node)];
+    return span == 0 ? 0 : span == RUN_SPAN ? RUN_CNT : WIDE_CNT;
 }
 
-// ========================================================================== //
+static inline void drop_head(node_t* root, node_t* head)
+{
+    if (head == get_root_tail(root))
+    {
+        free_queue_node(root, head);
+        make_root_single(root);
+        return;
+    }
 
+    node_t* next = get_node_next(head);
+    if (unlikely(clone_links != 0))
+    {
+        root_info_t* ri = &root_info[node_to_index(root)];
+        if (ri->link_from == node_to_index(head)) // clone is past shared nodes
+        {
+            next = index_to_node(ri->link_to);
+            ri->link_from = 0;
+            clone_links--;
+        }
+    }
 
-queueMetrics_t initQueues(unsigned char* buf, unsigned int len)
-{
-    assert(buf != NULL);
-    assert(len == 2048);
+    if (unlikely(is_spill(next)))
+    {
+        page_in(root, head, next);
+        return;
+    }
 
-    memset(buf, 0, len);
+    if (unlikely(shared_nodes != 0) && node_refs[node_to_index(next)] != 0)
+        share_head(root, next, NODE_PAYLOAD);
+    else
+        set_root_head(root, next, head_cnt(next));
+    free_queue_node(root, head);
+}
 
-    buffer = (node_t*) buf;
-    buffer_len = len;
-    buffer->as_pfree = 1;
+static inline unsigned int chunk_class(node_t* root)
+{
+    return nodes_class(root_info[node_to_index(root)].nodes);
+}
 
-    queueMetrics_t ret;
-    ret.name = "Eugene's impl";
-    ret.max_empty_queues = 255;
-    ret.max_nonempty_queues = 255;
-    ret.max_els_in_single = 1784;
-    ret.max_els_in_16even = 1769;
-    ret.max_els_in_64even = 1721;
-    ret.max_els_in_max_even_queues = 5;
-    ret.max_els_in_single_with_63_empty = 1343;
-    return ret;
+static inline unsigned int nodes_class(unsigned int nodes)
+{
+    if (nodes >= 4 * WIDE_EXT)
+        return WIDE_EXT;
+    if (nodes >= 2 * WIDE_EXT)
+        return WIDE_EXT / 2;
+    if (nodes >= 4 * WIDE_MAX)
+        return WIDE_MAX;
+    if (nodes >= 4 * WIDE_MIN)
+        return WIDE_MIN;
+    return 1;
 }
 
-Q* createQueue()
+static inline unsigned int fit_class(unsigned int span, unsigned int len)
 {
-    // create new empty root node and return it as handle
-    return (Q*) alloc_node();
+    // new chunk takes span * 7 new bytes, as span plain nodes would
+    while (span > 1 && len < span * NODE_PAYLOAD)
+        span = span > WIDE_MIN ? span / 2 : 1;
+    return span;
 }
 
-void destroyQueue(Q* q)
+static inline void append_tail(node_t* root, node_t* newtail)
 {
-    node_t* root = get_queue_root(q);
+    node_t* tail = get_root_tail(root);
 
-    if (is_single_root(root)) // if its only one node - just free it
+    if (is_run_tail(root)) // has own next field, nothing moves
     {
-        free_node(root);
+        set_node_next(tail, newtail);
+        set_root_tail(root, newtail, tail_cnt(newtail)); // head counter stays
         return;
     }
 
-    node_t* t = get_root_tail(root);
-    node_t* p = get_root_head(root);
-    free_node(root);
+    unsigned char moved;
 
-    if (t == p) // if its two nodes - free both
+    if (is_wide_tail(root))
     {
-        free_node(t);
-        return;
-    }
+        assert(wide_fill(tail) == wide_cap(node_span(tail)));
 
-    while (p != t) // walk through the chain and free them all
+        moved = ((unsigned char*) tail)[--tail->as_wide.end];
+        set_node_next(tail, newtail);
+        set_root_tail(root, newtail, 0); // head counter stays WIDE_CNT
+    }
+    else
     {
-        node_t* pp = get_node_next(p);
-        free_node(p);
-        p = pp;
+        moved = swap_tail(root, newtail);
     }
 
-    free_node(t);
+    root->as_root.cntt = tail_cnt(newtail);
+    push_tail_byte(root, moved);
 }
 
-void enqueueByte(Q* q, unsigned char b)
+static inline void push_tail_byte(node_t* root, unsigned char b)
 {
-    node_t* root = get_queue_root(q);
+    if (is_run_tail(root))
+    {
+        node_t* tail = get_root_tail(root);
+        assert(tail->as_run.b == b && tail->as_run.cnt < RUN_MAX);
+        tail->as_run.cnt++;
+        return;
+    }
 
-    if (is_single_root(root))
+    if (!is_wide_tail(root))
     {
-        if (!is_full_root(root))
-        {
-            push_single_root_data(root, b);
-        } 
-        else
+        push_tail_data(root, b);
+        return;
+    }
+
+    node_t* tail = get_root_tail(root);
+    unsigned int span = node_span(tail);
+    assert(wide_fill(tail) < wide_cap(span));
+
+    if (unlikely(tail->as_wide.end == span * sizeof(node_t) - 1))
+        compact_wide(tail);
+
+    ((unsigned char*) tail)[tail->as_wide.end++] = b;
+}
+
+static inline queueStatus_t enqueue_wide(node_t* root, unsigned char b)
+{
+    node_t* tail = get_root_tail(root);
+
+    if (likely(wide_fill(tail) < wide_cap(node_span(tail))))
+    {
+        push_tail_byte(root, b);
+        return QUEUE_OK;
+    }
+
+    node_t* newman;
+
+    if (rle_enabled(root) && tail_ends_with_run(root, b))
+    {
+        newman = alloc_tail_chunk(root, tail, 1);
+        if (unlikely(newman == NULL)) return alloc_failure(root);
+        init_run(newman, b);
+    }
+    else
+    {
+        newman = alloc_tail_chunk(root, tail, chunk_class(root));
+        if (unlikely(newman == NULL)) return alloc_failure(root);
+    }
+
+    append_tail(root, newman);
+    push_tail_byte(root, b);
+    return QUEUE_OK;
+}
+
+static inline queueStatus_t dequeue_wide(node_t* root, unsigned char* b)
+{
+    node_t* head = get_root_head(root);
+    unsigned char* d = (unsigned char*) head;
+
+    *b = shift_root_data(root, d[head->as_wide.start++]);
+
+    if (head->as_wide.start == head->as_wide.end)
+        drop_head(root, head);
+
+    return QUEUE_OK;
+}
+
+static inline unsigned int chunk_bytes(node_t* root, node_t* p, unsigned char** data)
+{
+    unsigned int span = chunk_span[node_to_index(p)];
+
+    if (unlikely(is_shared_head(root)) && p == get_root_head(root))
+    {
+        root_info_t* ri = &root_info[node_to_index(root)];
+        *data = span == RUN_SPAN ? NULL : (unsigned char*) p + ri->head_pos;
+        return ri->head_end - ri->head_pos;
+    }
+
+    if (span == RUN_SPAN)
+    {
+        *data = NULL;
+        return p->as_run.cnt;
+    }
+
+    if (span == SPILL_SPAN)
+    {
+        *data = NULL;
+        return spill_len(p);
+    }
+
+    if (span != 0)
+    {
+        *data = (unsigned char*) p + p->as_wide.start;
+        return wide_fill(p);
+    }
+
+    *data = p->as_node.data;
+    if (p == get_root_tail(root))
+        return root->as_root.cntt;
+    if (p == get_root_head(root))
+        return root->as_root.cnth;
+    return NODE_PAYLOAD;
+}
+
+// Run nodes
+
+static inline bool is_run_head(node_t* root)
+{
+    assert(!is_single_root(root));
+    return root->as_root.cnth == RUN_CNT;
+}
+
+static inline bool is_run_tail(node_t* root)
+{
+    // single root never has more than ROOT_PAYLOAD
+    return root->as_root.cntt == RUN_CNT;
+}
+
+static inline bool rle_enabled(node_t* root)
+{
+    return root_info[node_to_index(root)].flags & QUEUE_FLAG_RLE;
+}
+
+static inline bool tail_ends_with_run(node_t* root, unsigned char b)
+{
+    node_t* tail = get_root_tail(root);
+    uint64_t last;
+
+    if (is_wide_tail(root))
+        memcpy(&last, (unsigned char*) tail + tail->as_wide.end - sizeof(last), sizeof(last));
+    else
+        last = tail->as_pfree;
+
+    return last == 0x0101010101010101ull * b;
+}
+
+static inline void init_run(node_t* node, unsigned char b)
+{
+    chunk_span[node_to_index(node)] = RUN_SPAN;
+    node->as_run.b = b;
+    node->as_run.cnt = 0;
+}
+
+static inline void make_run_tail(node_t* root)
+{
+    assert(is_full_tail(root));
+
+    node_t* tail = get_root_tail(root);
+    if (is_headtail_root(root))
+        root->as_root.cnth = RUN_CNT;
+
+    init_run(tail, tail->as_tail.data[0]);
+    tail->as_run.cnt = TAIL_PAYLOAD;
+    root->as_root.cntt = RUN_CNT;
+}
+
+static inline unsigned int run_length(const unsigned char* src, unsigned int len,
+                                      unsigned char b, unsigned int max)
+{
+    unsigned int n = 0;
+    unsigned int lim = len < max ? len : max;
+
+    while (n < lim && src[n] == b)
+        n++;
+    return n;
+}
+
+static inline queueStatus_t enqueue_run(node_t* root, unsigned char b)
+{
+    node_t* tail = get_root_tail(root);
+
+    if (likely(tail->as_run.b == b && tail->as_run.cnt < RUN_MAX))
+    {
+        tail->as_run.cnt++;
+        return QUEUE_OK;
+    }
+
+    node_t* newman = alloc_tail_chunk(root, tail, chunk_class(root));
+    if (unlikely(newman == NULL)) return alloc_failure(root);
+    append_tail(root, newman);
+    push_tail_byte(root, b);
+    return QUEUE_OK;
+}
+
+static inline queueStatus_t dequeue_run(node_t* root, unsigned char* b)
+{
+    node_t* head = get_root_head(root);
+
+    *b = shift_root_data(root, head->as_run.b);
+
+    if (--head->as_run.cnt == 0)
+        drop_head(root, head);
+
+    return QUEUE_OK;
+}
+
+// Spill tier
+
+static inline bool is_spill(node_t* node)
+{
+    return chunk_span[node_to_index(node)] == SPILL_SPAN;
+}
+
+static inline unsigned int spill_len(node_t* node)
+{
+    unsigned char* l = node->as_spill.len;
+    return l[0] | (unsigned int) l[1] << 8 | (unsigned int) l[2] << 16;
+}
+
+static inline void set_spill_len(node_t* node, unsigned int len)
+{
+    assert(len <= SPILL_LEN_MAX);
+    node->as_spill.len[0] = len;
+    node->as_spill.len[1] = len >> 8;
+    node->as_spill.len[2] = len >> 16;
+}
+
+static bool spill_write(const unsigned char* src, unsigned int len, off_t at)
+{
+    while (len != 0)
+    {
+        ssize_t n = pwrite(spill_fd, src, len, at);
+        if (n <= 0)
+            return false;
+        src += n;
+        len -= n;
+        at += n;
+    }
+    return true;
+}
+
+static bool spill_read(unsigned char* dst, unsigned int len, off_t at)
+{
+    while (len != 0)
+    {
+        ssize_t n = pread(spill_fd, dst, len, at);
+        if (n <= 0)
+            return false;
+        dst += n;
+        len -= n;
+        at += n;
+    }
+    return true;
+}
+
+static bool spill_stretch(node_t* root, node_t* prev, node_t* end)
+{
+    unsigned char buf[NODE_COUNT * NODE_PAYLOAD];
+    unsigned int total = 0;
+    unsigned int nodes = 0;
+
+    for (node_t* p = get_node_next(prev); p != end; p = get_node_next(p))
+    {
+        unsigned char* d;
+        unsigned int n = chunk_bytes(root, p, &d);
+        memcpy(buf + total, d, n);
+        total += n;
+        nodes += node_span(p);
+    }
+
+    bool merge = is_spill(prev)
+        && prev->as_spill.off + spill_len(prev) == spill_end
+        && spill_len(prev) + total <= SPILL_LEN_MAX;
+
+    // new spill node takes one of freed nodes
+    if (nodes <= (merge ? 0u : 1u))
+        return false;
+    if (spill_end + total > UINT32_MAX || !spill_write(buf, total, spill_end))
+        return false;
+
+    for (node_t* p = get_node_next(prev); p != end; )
+    {
+        node_t* next = get_node_next(p);
+        free_queue_node(root, p);
+        p = next;
+    }
+
+    if (merge)
+    {
+        set_spill_len(prev, spill_len(prev) + total);
+        set_node_next(prev, end);
+    }
+    else
+    {
+        node_t* spill = alloc_queue_node(root, prev, 1);
+        assert(spill != NULL);
+        chunk_span[node_to_index(spill)] = SPILL_SPAN;
+        spill->as_spill.off = spill_end;
+        set_spill_len(spill, total);
+        set_node_next(spill, end);
+        set_node_next(prev, spill);
+    }
+
+    spill_end += total;
+    return true;
+}
+
+static bool __attribute__((cold)) spill_queue(node_t* root)
+{
+    if (spill_fd < 0 || is_single_root(root) || is_headtail_root(root))
+        return false;
+
+    node_t* tail = get_root_tail(root);
+    node_t* prev = get_root_head(root);
+    bool freed = false;
+
+    // runs are already compact, so each stretch of data nodes between
+    // head, run or spill nodes and tail is spilled on its own; nodes
+    // shared with clones stay, their links can not change
+    while (prev != tail)
+    {
+        node_t* end = chain_next(root, prev);
+        if (is_pinned(root, prev))
+        {
+            prev = end;
+            continue;
+        }
+        while (end != tail && !is_spill(end) && chunk_span[node_to_index(end)] != RUN_SPAN
+               && !is_pinned(root, end))
+            end = get_node_next(end);
+
+        if (spill_stretch(root, prev, end))
+            freed = true;
+        prev = end;
+    }
+
+    return freed;
+}
+
+static bool __attribute__((cold)) page_in(node_t* root, node_t* head, node_t* spill)
+{
+    if (head != spill)
+        free_queue_node(root, head);
+
+    unsigned int len = spill_len(spill);
+    unsigned int want = (len + NODE_PAYLOAD - 1) / NODE_PAYLOAD;
+    node_t* nodes[SPILL_BATCH];
+    unsigned int k = 0;
+
+    if (want > SPILL_BATCH)
+        want = SPILL_BATCH;
+    while (k < want)
+    {
+        node_t* node = alloc_queue_node(root, spill, 1);
+        if (node == NULL)
+            break;
+        nodes[k++] = node;
+    }
+    assert(k != 0 || head == spill);
+
+    // first node is head, it takes partial bytes so the rest are full
+    unsigned int n = k * NODE_PAYLOAD < len ? k * NODE_PAYLOAD : len;
+    unsigned int first = (n - 1) % NODE_PAYLOAD + 1;
+    unsigned char buf[SPILL_BATCH * NODE_PAYLOAD];
+
+    if (unlikely(k == 0 || !spill_read(buf, n, spill->as_spill.off)))
+    {
+        // spill node stays as head without bytes, next dequeue retries
+        while (k != 0)
+            free_queue_node(root, nodes[--k]);
+        set_root_head(root, spill, 0);
+        return false;
+    }
+    memcpy(nodes[0]->as_node.data, buf, first);
+    for (unsigned int i = 1; i < k; i++)
+    {
+        memcpy(nodes[i]->as_node.data, buf + first + (i - 1) * NODE_PAYLOAD, NODE_PAYLOAD);
+        set_node_next(nodes[i - 1], nodes[i]);
+    }
+
+    node_t* next = spill;
+    if (n == len)
+    {
+        next = get_node_next(spill);
+        free_queue_node(root, spill);
+    }
+    else
+    {
+        spill->as_spill.off += n;
+        set_spill_len(spill, len - n);
+    }
+
+    set_node_next(nodes[k - 1], next);
+    set_root_head(root, nodes[0], first);
+    return true;
+}
+
+static inline bool is_spill_head(node_t* root)
+{
+    assert(!is_single_root(root));
+    return root->as_root.cnth == 0 && !is_headtail_root(root);
+}
+
+// Clones
+
+static inline bool is_shared_head(node_t* root)
+{
+    assert(!is_single_root(root));
+    return root->as_root.cnth == SHARED_CNT;
+}
+
+static inline node_t* chain_next(node_t* root, node_t* node)
+{
+    if (unlikely(clone_links != 0))
+    {
+        root_info_t* ri = &root_info[node_to_index(root)];
+        if (ri->link_from == node_to_index(node))
+            return index_to_node(ri->link_to);
+    }
+    return get_node_next(node);
+}
+
+static inline bool is_pinned(node_t* root, node_t* node)
+{
+    unsigned int idx = node_to_index(node);
+    return node_refs[idx] != 0
+        || (clone_links != 0 && root_info[node_to_index(root)].link_from == idx);
+}
+
+static inline bool unref_node(node_t* node)
+{
+    unsigned char* refs = &node_refs[node_to_index(node)];
+
+    if (likely(*refs == 0))
+        return false;
+    if (--*refs == 0)
+        shared_nodes--;
+    return true;
+}
+
+static void share_head(node_t* root, node_t* head, unsigned int cnt)
+{
+    root_info_t* ri = &root_info[node_to_index(root)];
+    unsigned int span = chunk_span[node_to_index(head)];
+
+    if (span == 0)
+    {
+        ri->head_pos = 0;
+        ri->head_end = cnt;
+    }
+    else if (span == RUN_SPAN)
+    {
+        ri->head_pos = 0;
+        ri->head_end = head->as_run.cnt;
+    }
+    else
+    {
+        ri->head_pos = head->as_wide.start;
+        ri->head_end = head->as_wide.end;
+    }
+    set_root_head(root, head, SHARED_CNT);
+}
+
+static inline queueStatus_t dequeue_shared(node_t* root, unsigned char* b)
+{
+    root_info_t* ri = &root_info[node_to_index(root)];
+    node_t* head = get_root_head(root);
+    unsigned char v = chunk_span[node_to_index(head)] == RUN_SPAN
+        ? head->as_run.b : ((unsigned char*) head)[ri->head_pos];
+
+    *b = shift_root_data(root, v);
+
+    if (++ri->head_pos == ri->head_end)
+        drop_head(root, head);
+
+    return QUEUE_OK;
+}
+
+// Trace
+
+#ifdef QUEUE_TRACE
+static inline uint64_t trace_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return trace_ns();
+#endif
+}
+
+static uint64_t trace_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline unsigned int trace_path(node_t* root)
+{
+    if (is_single_root(root))
+        return QUEUE_TRACE_SINGLE;
+    return is_headtail_root(root) ? QUEUE_TRACE_HEADTAIL : QUEUE_TRACE_CHAIN;
+}
+
+static inline void trace_event(node_t* root, unsigned int op, uint64_t t0,
+                               unsigned int used, unsigned int path, int status)
+{
+    queueTraceEvent_t* e = &trace_ring[trace_cnt++ % QUEUE_TRACE_SIZE];
+
+    e->tsc = t0;
+    e->ticks = trace_clock() - t0;
+    e->op = op;
+    e->root = node_to_index(root);
+    e->path = arena_used > used ? QUEUE_TRACE_ALLOC
+            : arena_used < used ? QUEUE_TRACE_FREE : path;
+    e->status = status;
+}
+#endif
+
+
+// ========================================================================== //
+
+static node_t* alloc_node(node_t* near)
+{
+    unsigned int idx = near != NULL ? free_slot_near(node_to_index(near)) : 0;
+
+    if (idx == 0)
+        idx = buffer->as_arena.free;
+
+    if (idx != 0)
+    {
+        unlink_free(idx);
+    }
+    else
+    {
+        if (unlikely(buffer->as_arena.bump >= arena_nodes))
+            return NULL;
+        idx = buffer->as_arena.bump++;
+        index_to_node(idx)->as_pfree = 0; // bump region is zeroed lazily
+        chunk_span[idx] = 0;
+        node_refs[idx] = 0;
+    }
+
+    account_nodes(1);
+    return index_to_node(idx);
+}
+
+static node_t* alloc_wide(unsigned int span)
+{
+    unsigned int idx = 0;
+
+    // aligned run of free list nodes first, extents take whole lines
+    if (span > LINE_NODES)
+    {
+        unsigned int lines = span / LINE_NODES;
+        for (unsigned int line = 0; idx == 0 && line < arena_nodes / LINE_NODES; line += lines)
+        {
+            unsigned int l = 0;
+            while (l < lines && free_lines[line + l] == 0xFF)
+                l++;
+            if (l == lines)
+                idx = line * LINE_NODES;
+        }
+    }
+    else
+    {
+        unsigned int want = (1u << span) - 1;
+        for (unsigned int line = 0; idx == 0 && line < arena_nodes / LINE_NODES; line++)
+        {
+            unsigned int mask = free_lines[line];
+            for (unsigned int off = 0; off < LINE_NODES; off += span)
+            {
+                if (((mask >> off) & want) == want)
+                {
+                    idx = line * LINE_NODES + off;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (idx != 0)
+    {
+        for (unsigned int i = 0; i < span; i++)
+            unlink_free(idx + i);
+    }
+    else
+    {
+        // bump region, nodes skipped to align go to free list
+        unsigned int bump = buffer->as_arena.bump;
+        idx = (bump + span - 1) & ~(span - 1);
+        if (idx + span > arena_nodes)
+            return NULL;
+        memset(&chunk_span[bump], 0, idx + span - bump);
+        memset(&node_refs[bump], 0, idx + span - bump);
+        while (bump < idx)
+            push_free(bump++);
+        buffer->as_arena.bump = idx + span;
+        memset(index_to_node(idx), 0, span * sizeof(node_t));
+    }
+
+    chunk_span[idx] = span;
+    node_t* chunk = index_to_node(idx);
+    chunk->as_wide.start = WIDE_HDR;
+    chunk->as_wide.end = WIDE_HDR;
+
+    account_nodes(span);
+    return chunk;
+}
+
+static void free_node(node_t* node)
+{
+    assert(bounds_check(node));
+
+    unsigned int idx = node_to_index(node);
+    unsigned int span = node_span(node);
+
+    chunk_span[idx] = 0;
+    for (unsigned int i = 0; i < span; i++)
+        push_free(idx + i);
+
+    account_nodes(-(int)span);
+}
+
+static inline void push_free(unsigned int idx)
+{
+    node_t* node = index_to_node(idx);
+    unsigned int head = buffer->as_arena.free;
+
+    node->as_free.next = head;
+    node->as_free.prev = 0;
+    if (head != 0)
+        index_to_node(head)->as_free.prev = idx;
+    buffer->as_arena.free = idx;
+
+    free_lines[idx / LINE_NODES] |= 1u << (idx % LINE_NODES);
+}
+
+static inline void unlink_free(unsigned int idx)
+{
+    node_t* node = index_to_node(idx);
+    unsigned int next = node->as_free.next;
+    unsigned int prev = node->as_free.prev;
+
+    if (prev != 0)
+        index_to_node(prev)->as_free.next = next;
+    else
+        buffer->as_arena.free = next;
+
+    if (next != 0)
+        index_to_node(next)->as_free.prev = prev;
+
+    free_lines[idx / LINE_NODES] &= ~(1u << (idx % LINE_NODES));
+    node->as_pfree = 0;
+}
+
+static inline unsigned int free_slot_near(unsigned int at)
+{
+    unsigned int line = at / LINE_NODES;
+    unsigned int mask = free_lines[line];
+
+    if (mask == 0)
+        return 0;
+
+    // prefer slots after given one, chain is walked forward
+    unsigned int after = mask & (0xFEu << (at % LINE_NODES));
+    return line * LINE_NODES + __builtin_ctz(after != 0 ? after : mask);
+}
+
+static inline void account_nodes(int delta)
+{
+    unsigned int before = arena_used;
+    arena_used += delta;
+
+    // moves by more than 1 with wide chunks, so check for crossing
+    if (unlikely((before < wm_high && arena_used >= wm_high) ||
+                 (before > wm_low  && arena_used <= wm_low)))
+        check_watermarks();
+}
+
+static inline unsigned int arena_free()
+{
+    return arena_nodes - 1 - arena_used;
+}
+
+static inline unsigned int arena_unreserved()
+{
+    unsigned int free = arena_free();
+    return free > arena_reserved ? free - arena_reserved : 0;
+}
+
+static bool __attribute__((cold)) grow_arena(unsigned int cnt)
+{
+    while (arena_unreserved() < cnt)
+    {
+        if (onSegmentAlloc == NULL || arena_nodes == NODE_COUNT)
+            return false;
+
+        unsigned char* seg = onSegmentAlloc();
+        if (seg == NULL)
+            return false;
+
+        seg_base[arena_nodes / SEG_NODES] = (node_t*) seg;
+        arena_nodes += SEG_NODES;
+    }
+    return true;
+}
+
+static inline node_t* alloc_queue_node(node_t* root, node_t* near, unsigned int span)
+{
+    root_info_t* ri = &root_info[node_to_index(root)];
+    unsigned int own = ri->qresv;
+
+    if (unlikely(check_queue_nodes(root, span) != QUEUE_OK))
+        return NULL;
+
+    node_t* node = span == 1
+        ? alloc_node(alloc_policy == QUEUE_ALLOC_NEAR_TAIL ? near : NULL)
+        : alloc_wide(span);
+    if (node == NULL) // only wide chunk can fail, no aligned room
+        return NULL;
+
+    // take from own reservation, quota first, then reserveCapacity one
+    unsigned int take = span < own ? span : own;
+    unsigned int held = span - take < ri->resv ? span - take : ri->resv;
+    arena_reserved -= take + held;
+    ri->qresv -= take;
+    ri->resv -= held;
+    ri->nodes += span;
+    return node;
+}
+
+static inline node_t* alloc_tail_chunk(node_t* root, node_t* tail, unsigned int span)
+{
+    for (; span > 1; span = span > WIDE_MIN ? span / 2 : 1)
+    {
+        node_t* chunk = alloc_queue_node(root, tail, span);
+        if (chunk != NULL)
+            return chunk;
+    }
+
+    node_t* node = alloc_queue_node(root, tail, 1);
+    if (unlikely(node == NULL) && spill_queue(root))
+        node = alloc_queue_node(root, tail, 1);
+    return node;
+}
+
+static inline void free_queue_node(node_t* root, node_t* node)
+{
+    root_info_t* ri = &root_info[node_to_index(root)];
+    unsigned int span = node_span(node);
+
+    assert(ri->nodes >= span);
+    ri->nodes -= span;
+
+    if (unlikely(shared_nodes != 0) && unref_node(node)) // other queues still hold it
+        return;
+    free_node(node);
+
+    // quota_min takes back at most nodes that got free
+    unsigned int need = ri->nodes < ri->quota_min ? ri->quota_min - ri->nodes : 0;
+    unsigned int add = need > ri->qresv ? need - ri->qresv : 0;
+    add = add < span ? add : span;
+    ri->qresv += add;
+    arena_reserved += add;
+}
+
+static queueStatus_t __attribute__((cold)) alloc_failure(node_t* root)
+{
+    root_info_t* ri = &root_info[node_to_index(root)];
+
+    if (ri->quota_max != 0 && ri->nodes >= ri->quota_max)
+        return QUEUE_OVER_QUOTA;
+
+    return QUEUE_OUT_OF_MEM;
+}
+
+static void check_watermarks()
+{
+    if (!wm_above && arena_used >= wm_high)
+    {
+        wm_above = true;
+        if (onHighWatermark != NULL)
+            onHighWatermark(arena_used);
+    }
+    else if (wm_above && arena_used <= wm_low)
+    {
+        wm_above = false;
+        if (onLowWatermark != NULL)
+            onLowWatermark(arena_used);
+    }
+}
+
+static void on_queue_ready(node_t* root)
+{
+    unsigned int idx = node_to_index(root);
+    root_info_t* ri = &root_info[idx];
+
+    ready_set[idx / 64] |= 1ull << (idx % 64);
+
+    if (ri->group != NULL)
+        ri->group->ready |= 1ull << ri->level;
+
+    queueNotifier_t* n = ri->notifier;
+
+    if (n == NULL || n->pending)
+        return;
+
+    n->pending = 1;
+    uint64_t one = 1;
+    ssize_t r = write(n->fd, &one, sizeof(one));
+    (void)r; // nothing to do if fd is full or broken, consumer will see pending
+}
+
+static void on_queue_empty(node_t* root)
+{
+    unsigned int idx = node_to_index(root);
+    root_info_t* ri = &root_info[idx];
+
+    ready_set[idx / 64] &= ~(1ull << (idx % 64));
+
+    if (ri->group != NULL)
+        ri->group->ready &= ~(1ull << ri->level);
+}
+
+static inline unsigned int find_ready(unsigned int from)
+{
+    for (unsigned int w = from / 64; w < NODE_COUNT / 64; w++)
+    {
+        uint64_t bits = ready_set[w];
+        if (w == from / 64)
+            bits &= ~0ull << (from % 64);
+        if (bits != 0)
+            return w * 64 + __builtin_ctzll(bits);
+    }
+
+    return 0; // node 0 is never a root
+}
+
+// ========================================================================== //
+
+
+queueMetrics_t initQueues(unsigned char* buf, unsigned int len)
+{
+    assert(buf != NULL);
+    assert(len % QUEUE_SEGMENT_SIZE == 0 && len != 0 && len <= 2048);
+
+    // segments of previous arena go back
+    for (unsigned int s = buffer_nodes / SEG_NODES; s < arena_nodes / SEG_NODES; s++)
+        if (onSegmentFree != NULL)
+            onSegmentFree((unsigned char*) seg_base[s]);
+
+    // root_info and per node tables are reset lazily, see resetArena
+    memset(ready_set, 0, sizeof(ready_set));
+    arena_gen++;
+    arena_used = 0;
+    arena_reserved = 0;
+    wm_above = false;
+
+    buffer = (node_t*) buf;
+    buffer_nodes = len / sizeof(node_t);
+#ifdef QUEUE_INLINE
+    queueInlineBuf = buf;
+    queueInlineNodes = buffer_nodes;
+#endif
+    arena_nodes = buffer_nodes;
+    memset(seg_base, 0, sizeof(seg_base));
+    for (unsigned int s = 0; s < buffer_nodes / SEG_NODES; s++)
+        seg_base[s] = buffer + s * SEG_NODES;
+    buffer->as_arena.free = 0;
+    buffer->as_arena.bump = 1;
+    memset(free_lines, 0, sizeof(free_lines));
+    shared_nodes = 0;
+    clone_links = 0;
+
+#ifdef QUEUE_TRACE
+    trace_cnt = 0;
+    trace_tsc_base = trace_clock();
+    trace_ns_base = trace_ns();
+#endif
+
+    queueMetrics_t ret;
+    ret.name = "Eugene's impl";
+    ret.max_empty_queues = 255;
+    ret.max_nonempty_queues = 255;
+    ret.max_els_in_single = 1784;
+    ret.max_els_in_16even = 1769;
+    ret.max_els_in_64even = 1721;
+    ret.max_els_in_max_even_queues = 5;
+    ret.max_els_in_single_with_63_empty = 1343;
+    return ret;
+}
+
+Q* tryCreateQueue()
+{
+    // create new empty root node and return it as handle
+    node_t* root = grow_arena(1) ? alloc_node(NULL) : NULL;
+    if (unlikely(root == NULL))
+        return NULL;
+
+    root_info[node_to_index(root)] = (root_info_t){ 0 };
+    return get_queue_handle(root);
+}
+
+Q* createQueue()
+{
+    Q* q = tryCreateQueue();
+    if (unlikely(q == NULL))
+        onOutOfMemory();
+    return q;
+}
+
+void destroyQueue(Q* q)
+{
+    node_t* root = get_queue_root(q);
+
+    // give back what is left from reservation
+    root_info_t* ri = &root_info[node_to_index(root)];
+    arena_reserved -= ri->qresv + ri->resv;
+
+    if (ri->group != NULL)
+        bindPrioQueue(ri->group, ri->level, NULL);
+
+    if (!is_empty_root(root))
+        on_queue_empty(root);
+
+    if (is_single_root(root)) // if its only one node - just free it
+    {
+        free_node(root);
+        return;
+    }
+
+    node_t* t = get_root_tail(root);
+    node_t* p = get_root_head(root);
+    free_node(root);
+
+    while (p != t) // walk through the chain and free them all, shared nodes stay
+    {
+        node_t* pp = chain_next(root, p);
+        if (!unref_node(p))
+            free_node(p);
+        p = pp;
+    }
+
+    if (ri->link_from != 0)
+    {
+        ri->link_from = 0;
+        clone_links--;
+    }
+
+    free_node(t);
+}
+
+void destroyQueues(Q* queues[], unsigned int n)
+{
+    assert(queues != NULL || n == 0);
+
+    // nodes of roots and chains, shared ones would be counted twice
+    unsigned int nodes = 0;
+    for (unsigned int i = 0; i < n; i++)
+        nodes += 1 + root_info[node_to_index(get_queue_root(queues[i]))].nodes;
+
+    if (nodes != arena_used || shared_nodes != 0 || clone_links != 0)
+    {
+        for (unsigned int i = 0; i < n; i++)
+            destroyQueue(queues[i]);
+        return;
+    }
+
+    // no other queue is left, only groups point outside of arena
+    for (unsigned int i = 0; i < n; i++)
+    {
+        root_info_t* ri = &root_info[node_to_index(get_queue_root(queues[i]))];
+        if (ri->group != NULL)
+            bindPrioQueue(ri->group, ri->level, NULL);
+    }
+
+    resetArena();
+}
+
+unsigned int resetArena()
+{
+    // fire low watermark as if nodes were freed
+    account_nodes(-(int)arena_used);
+    arena_reserved = 0;
+
+    // old nodes stay as they are, bump region zeroes them lazily
+    buffer->as_arena.free = 0;
+    buffer->as_arena.bump = 1;
+
+    // bitmaps only, per node side tables are reset as bump hands
+    // nodes out, root_info as queue is created; new generation
+    // makes group bindings left in root_info stale
+    memset(free_lines, 0, sizeof(free_lines));
+    memset(ready_set, 0, sizeof(ready_set));
+    shared_nodes = 0;
+    clone_links = 0;
+
+    return ++arena_gen;
+}
+
+Q* cloneQueue(Q* q)
+{
+    node_t* src = get_queue_root(q);
+    root_info_t* si = &root_info[node_to_index(src)];
+
+    node_t* root = grow_arena(1) ? alloc_node(NULL) : NULL;
+    if (unlikely(root == NULL))
+        return NULL;
+
+    root_info_t* ri = &root_info[node_to_index(root)];
+    *ri = (root_info_t){ 0 };
+    ri->flags = si->flags;
+    *root = *src;
+
+    if (is_single_root(src))
+    {
+        if (!is_empty_root(root))
+            on_queue_ready(root);
+        return get_queue_handle(root);
+    }
+
+    // nodes up to last shared one are shared: up to one before tail,
+    // or up to queue's own last shared node if it is clone, so nodes
+    // after it are copied and clone needs one own link only
+    node_t* head = get_root_head(src);
+    node_t* tail = get_root_tail(src);
+    node_t* last = NULL;
+
+    if (head != tail)
+    {
+        last = si->link_from != 0 ? index_to_node(si->link_from) : head;
+        for (node_t* p = head; p != tail; p = chain_next(src, p))
+        {
+            if (is_spill(p)) // spilled data is not shared
+            {
+                free_node(root);
+                return NULL;
+            }
+            if (si->link_from == 0 && chain_next(src, p) == tail)
+                last = p;
+        }
+    }
+
+    node_t* copies[NODE_COUNT];
+    unsigned int k = 0;
+
+    for (node_t* p = last != NULL ? chain_next(src, last) : head; ; p = chain_next(src, p))
+    {
+        // wide tail is copied to smallest chunk its bytes fit
+        unsigned int span = node_span(p);
+        unsigned int fill = span > 1 && p == tail ? wide_fill(p) : 0;
+        if (fill != 0)
+            for (span = fill <= TAIL_PAYLOAD ? 1 : WIDE_MIN; span > 1 && wide_cap(span) < fill; )
+                span *= 2;
+
+        node_t* copy = alloc_queue_node(root, k != 0 ? copies[k - 1] : p, span);
+        if (copy == NULL)
+        {
+            while (k != 0)
+                free_queue_node(root, copies[--k]);
+            free_node(root);
+            return NULL;
+        }
+
+        if (fill == 0)
+        {
+            memcpy(copy, p, span * sizeof(node_t));
+            chunk_span[node_to_index(copy)] = chunk_span[node_to_index(p)];
+        }
+        else if (span == 1)
+        {
+            memcpy(copy->as_tail.data, (unsigned char*) p + p->as_wide.start, fill);
+            root->as_root.cntt = fill;
+            if (last == NULL) // plain head and tail have same counter
+                root->as_root.cnth = fill;
+        }
+        else
+        {
+            memcpy((unsigned char*) copy + WIDE_HDR, (unsigned char*) p + p->as_wide.start, fill);
+            copy->as_wide.start = WIDE_HDR;
+            copy->as_wide.end = WIDE_HDR + fill;
+            chunk_span[node_to_index(copy)] = span;
+        }
+        if (k != 0)
+            set_node_next(copies[k - 1], copy);
+        copies[k++] = copy;
+        if (p == tail)
+            break;
+    }
+
+    root->as_root.tail = node_to_index(copies[k - 1]);
+    if (last == NULL)
+    {
+        root->as_root.head = root->as_root.tail;
+        on_queue_ready(root);
+        return get_queue_handle(root);
+    }
+
+    for (node_t* p = head; ; p = chain_next(src, p))
+    {
+        if (node_refs[node_to_index(p)]++ == 0)
+            shared_nodes++;
+        ri->nodes += node_span(p);
+        if (p == last)
+            break;
+    }
+
+    // both read shared head in place from now on
+    if (!is_shared_head(src))
+        share_head(src, head, src->as_root.cnth);
+    root->as_root.cnth = SHARED_CNT;
+    ri->head_pos = si->head_pos;
+    ri->head_end = si->head_end;
+
+    ri->link_from = node_to_index(last);
+    ri->link_to = node_to_index(copies[0]);
+    clone_links++;
+
+    on_queue_ready(root);
+    return get_queue_handle(root);
+}
+
+static inline queueStatus_t enqueue_byte(node_t* root, unsigned char b)
+{
+    if (is_single_root(root))
+    {
+        if (is_empty_root(root))
+        {
+            push_single_root_data(root, b);
+            on_queue_ready(root);
+        }
+        else if (!is_full_root(root))
+        {
+            push_single_root_data(root, b);
+        }
+        else
+        {
+            node_t* newman = alloc_queue_node(root, root, 1);
+            if (unlikely(newman == NULL)) return alloc_failure(root);
+            set_root_tail(root, newman, 0);
+            set_root_head(root, newman, 0);
+            push_tail_data(root, b);
+        }
+        return QUEUE_OK;
+    }
+
+
+
+    if (is_wide_tail(root))
+        return enqueue_wide(root, b);
+
+    if (is_run_tail(root))
+        return enqueue_run(root, b);
+
+    if (is_full_tail(root))
+    {
+        if (rle_enabled(root) && tail_ends_with_run(root, b))
+        {
+            make_run_tail(root);
+            return enqueue_run(root, b);
+        }
+
+        // we run out fo tail data
+        node_t* newman = alloc_tail_chunk(root, get_root_tail(root), chunk_class(root));
+        if (unlikely(newman == NULL)) return alloc_failure(root);
+        if (chunk_span[node_to_index(newman)] != 0)
+        {
+            append_tail(root, newman);
+            push_tail_byte(root, b);
+            return QUEUE_OK;
+        }
+        char old_b = swap_tail(root, newman);
+        push_tail_data2(root, old_b, b);
+        return QUEUE_OK;
+
+    }
+
+    push_tail_data(root, b);
+    return QUEUE_OK;
+}
+
+static inline queueStatus_t dequeue_byte(node_t* root, unsigned char* b)
+{
+    if (unlikely(is_empty_root(root)))
+    {
+        return QUEUE_EMPTY;
+    }
+
+    if (is_single_root(root))
+    {
+        *b = pop_single_root_data(root);
+        if (is_empty_root(root))
+            on_queue_empty(root);
+        return QUEUE_OK;
+    }
+
+    if (root->as_root.cnth > TAIL_PAYLOAD) // wide, run or shared head
+    {
+        if (is_wide_head(root))
+            return dequeue_wide(root, b);
+
+        if (is_run_head(root))
+            return dequeue_run(root, b);
+
+        return dequeue_shared(root, b);
+    }
+
+    if (is_headtail_root(root))
+    {
+
+        unsigned char tail_ret = pop_tail_data(root); // pops from 8 data field
+        *b = shift_root_data(root, tail_ret);
+
+        if (is_empty_tail(root))
+        {
+            free_queue_node(root, get_root_tail(root));
+            make_root_single(root);
+        }
+
+        return QUEUE_OK;
+    }
+
+    if (unlikely(is_spill_head(root)) && !page_in(root, get_root_head(root), get_root_head(root)))
+        return QUEUE_IO_ERROR;
+
+    unsigned char head_ret = pop_head_data(root);
+    *b = shift_root_data(root, head_ret);
+
+    if (is_empty_head(root))
+        drop_head(root, get_root_head(root));
+
+    return QUEUE_OK;
+}
+
+static inline unsigned int nodes_needed(node_t* root, unsigned int len)
+{
+    // every new node takes 7 bytes, as 8th byte of full tail moves to it
+    if (is_single_root(root))
+    {
+        unsigned int room = ROOT_PAYLOAD - root->as_root.cntt;
+        if (len <= room)
+            return 0;
+        len -= room;
+        return len <= TAIL_PAYLOAD ? 1 : 1 + (len - TAIL_PAYLOAD + NODE_PAYLOAD - 1) / NODE_PAYLOAD;
+    }
+
+    // wide chunk of N nodes takes N * 7 bytes too, run nodes take
+    // at least 7 bytes, so runs are not counted - it is upper bound
+    unsigned int room;
+    if (is_wide_tail(root))
+    {
+        node_t* tail = get_root_tail(root);
+        room = wide_cap(node_span(tail)) - wide_fill(tail);
+    }
+    else if (is_run_tail(root))
+    {
+        room = 0;
+    }
+    else
+    {
+        room = TAIL_PAYLOAD - root->as_root.cntt;
+    }
+
+    if (len <= room)
+        return 0;
+    return (len - room + NODE_PAYLOAD - 1) / NODE_PAYLOAD;
+}
+
+static unsigned int nodes_needed_rle(node_t* root, unsigned int plain,
+                                     const unsigned char* src, unsigned int len)
+{
+    unsigned int runs = 0;
+
+    for (unsigned int i = 0; i < len; )
+    {
+        unsigned int r = run_length(src + i, len - i, src[i], len - i);
+        if (r > RUN_LEAD)
+        {
+            plain += RUN_LEAD;
+            runs += (r - RUN_LEAD + RUN_MAX - 1) / RUN_MAX;
+        }
+        else
+        {
+            plain += r;
+        }
+        i += r;
+    }
+
+    return nodes_needed(root, plain) + runs;
+}
+
+static unsigned int nodes_needed_any(node_t* root, unsigned int len)
+{
+    unsigned int cnt = nodes_needed(root, len);
+    if (cnt == 0)
+        return 0;
+
+    // chunks before last one are full, so they take cnt nodes or less
+    unsigned int span = nodes_class(root_info[node_to_index(root)].nodes + cnt);
+    bool wide = span > 1 || (!is_single_root(root) && is_wide_tail(root));
+    cnt += span - 1;
+
+    // run node follows full wide chunk only, which takes WIDE_MIN
+    // nodes at least, plus one after tail queue has now
+    if (rle_enabled(root) && wide)
+        cnt += 1 + cnt / WIDE_MIN;
+    return cnt;
+}
+
+static inline queueStatus_t check_queue_nodes(node_t* root, unsigned int cnt)
+{
+    if (cnt == 0)
+        return QUEUE_OK;
+
+    root_info_t* ri = &root_info[node_to_index(root)];
+    if (likely(cnt <= ri->resv)) // checked by reserveCapacity
+        return QUEUE_OK;
+
+    unsigned int own = ri->qresv + ri->resv;
+
+    if (unlikely(ri->quota_max != 0 && ri->nodes + cnt > ri->quota_max))
+        return QUEUE_OVER_QUOTA;
+    if (unlikely(cnt > own && cnt - own > arena_unreserved()) && !grow_arena(cnt - own))
+        return QUEUE_OUT_OF_MEM;
+
+    return QUEUE_OK;
+}
+
+static inline queueStatus_t make_room(node_t* root, unsigned int cnt)
+{
+    queueStatus_t st = check_queue_nodes(root, cnt);
+
+    // spill does not change tail, so cnt stays right
+    while (unlikely(st != QUEUE_OK) && spill_queue(root))
+        st = check_queue_nodes(root, cnt);
+    return st;
+}
+
+static inline bool queue_has_bytes(node_t* root, unsigned int len)
+{
+    if (is_single_root(root))
+        return root->as_root.cntt >= len;
+
+    unsigned int cnt = ROOT_PAYLOAD;
+    node_t* t = get_root_tail(root);
+    node_t* p = get_root_head(root);
+    unsigned char* d;
+
+    while (cnt < len)
+    {
+        cnt += chunk_bytes(root, p, &d);
+        if (p == t)
+            break;
+        p = chain_next(root, p);
+    }
+
+    return cnt >= len;
+}
+
+static unsigned int take_chain(node_t* root, unsigned char* dst, unsigned int len)
+{
+    unsigned int got = 0;
+
+    while (got < len && !is_single_root(root))
+    {
+        if (is_wide_head(root))
+        {
+            node_t* head = get_root_head(root);
+            unsigned char* d = (unsigned char*) head + head->as_wide.start;
+            unsigned int cnt = wide_fill(head);
+            unsigned int n = len - got < cnt ? len - got : cnt;
+
+            if (dst != NULL)
+                memcpy(dst + got, d, n);
+            head->as_wide.start += n;
+            got += n;
+
+            if (n == cnt)
+                drop_head(root, head);
+            continue;
+        }
+
+        if (is_run_head(root))
+        {
+            node_t* head = get_root_head(root);
+            unsigned int cnt = head->as_run.cnt;
+            unsigned int n = len - got < cnt ? len - got : cnt;
+
+            if (dst != NULL)
+                memset(dst + got, head->as_run.b, n);
+            head->as_run.cnt = cnt - n;
+            got += n;
+
+            if (n == cnt)
+                drop_head(root, head);
+            continue;
+        }
+
+        if (is_shared_head(root))
+        {
+            node_t* head = get_root_head(root);
+            unsigned char* d;
+            unsigned int cnt = chunk_bytes(root, head, &d);
+            unsigned int n = len - got < cnt ? len - got : cnt;
+
+            if (dst != NULL && d != NULL)
+                memcpy(dst + got, d, n);
+            else if (dst != NULL)
+                memset(dst + got, head->as_run.b, n);
+            root_info[node_to_index(root)].head_pos += n;
+            got += n;
+
+            if (n == cnt)
+                drop_head(root, head);
+            continue;
+        }
+
+        if (is_headtail_root(root))
+        {
+            node_t* tail = get_root_tail(root);
+            unsigned char* d = tail->as_tail.data;
+            unsigned int cnt = root->as_root.cntt;
+            unsigned int n = len - got < cnt ? len - got : cnt;
+
+            if (dst != NULL)
+                memcpy(dst + got, d, n);
+            memmove(d, d + n, cnt - n);
+            got += n;
+            root->as_root.cntt = cnt - n;
+            root->as_root.cnth = cnt - n;
+
+            if (is_empty_tail(root))
+            {
+                free_queue_node(root, tail);
+                root->as_root.head = 0;
+                root->as_root.tail = 0;
+                root->as_root.cnth = 0;
+            }
+            continue;
+        }
+
+        if (unlikely(is_spill_head(root)) && !page_in(root, get_root_head(root), get_root_head(root)))
+            break;
+
+        node_t* head = get_root_head(root);
+        unsigned char* d = head->as_node.data;
+        unsigned int cnt = root->as_root.cnth;
+        unsigned int n = len - got < cnt ? len - got : cnt;
+
+        if (dst != NULL)
+            memcpy(dst + got, d, n);
+        memmove(d, d + n, cnt - n);
+        got += n;
+        root->as_root.cnth = cnt - n;
+
+        if (is_empty_head(root))
+            drop_head(root, head);
+    }
+
+    return got;
+}
+
+static inline queueStatus_t enqueue_bytes(node_t* root, const unsigned char* src, unsigned int len)
+{
+    unsigned int cnt = rle_enabled(root) ? nodes_needed_rle(root, 0, src, len)
+                                         : nodes_needed(root, len);
+    queueStatus_t st = make_room(root, cnt);
+    if (unlikely(st != QUEUE_OK))
+        return st;
+
+    if (unlikely(append_bytes(root, src, len) != len))
+        return QUEUE_OUT_OF_MEM;
+    return QUEUE_OK;
+}
+
+static unsigned int append_bytes(node_t* root, const unsigned char* src, unsigned int len)
+{
+    unsigned int total = len;
+
+    if (is_single_root(root))
+    {
+        bool was_empty = is_empty_root(root);
+        unsigned int cnt = root->as_root.cntt;
+        unsigned int n = len < ROOT_PAYLOAD - cnt ? len : ROOT_PAYLOAD - cnt;
+
+        memcpy(root->as_root.data + cnt, src, n);
+        root->as_root.cntt = cnt + n;
+        src += n;
+        len -= n;
+
+        if (was_empty && n != 0)
+            on_queue_ready(root);
+
+        if (len == 0)
+            return total;
+
+        node_t* newman = alloc_queue_node(root, root, 1);
+        if (unlikely(newman == NULL))
+            return total - len;
+        set_root_tail(root, newman, 0);
+        set_root_head(root, newman, 0);
+    }
+
+    for (;;)
+    {
+        node_t* tail = get_root_tail(root);
+        unsigned int n;
+
+        if (is_run_tail(root))
+        {
+            n = run_length(src, len, tail->as_run.b, RUN_MAX - tail->as_run.cnt);
+            tail->as_run.cnt += n;
+        }
+        else if (is_wide_tail(root))
+        {
+            unsigned int room = wide_cap(node_span(tail)) - wide_fill(tail);
+            n = len < room ? len : room;
+
+            if (tail->as_wide.end + n > node_span(tail) * sizeof(node_t) - 1)
+                compact_wide(tail);
+            memcpy((unsigned char*) tail + tail->as_wide.end, src, n);
+            tail->as_wide.end += n;
+        }
+        else
+        {
+            unsigned int cnt = root->as_root.cntt;
+            n = len < TAIL_PAYLOAD - cnt ? len : TAIL_PAYLOAD - cnt;
+
+            memcpy(tail->as_tail.data + cnt, src, n);
+            root->as_root.cntt = cnt + n;
+        }
+        src += n;
+        len -= n;
+
+        if (len == 0)
+            return total;
+
+        // tail is full here, turn it or next node into run
+        if (rle_enabled(root) && !is_run_tail(root) && tail_ends_with_run(root, *src))
+        {
+            if (!is_wide_tail(root))
+            {
+                make_run_tail(root);
+                continue;
+            }
+            if (run_length(src, len, *src, NODE_PAYLOAD) == NODE_PAYLOAD)
+            {
+                node_t* run = alloc_queue_node(root, tail, 1);
+                if (unlikely(run == NULL))
+                    return total - len;
+                init_run(run, *src);
+                append_tail(root, run);
+                continue;
+            }
+        }
+
+        // space is checked by caller, so allocation fails only if
+        // node count estimate is short: wide chunk is taken only if
+        // rest of data fills it, so takes same nodes
+        unsigned int span = fit_class(chunk_class(root), len);
+        node_t* chunk = alloc_tail_chunk(root, tail, span);
+        if (unlikely(chunk == NULL))
+            return total - len;
+        append_tail(root, chunk);
+    }
+}
+
+static inline unsigned int dequeue_bytes(node_t* root, unsigned char* dst, unsigned int len)
+{
+    unsigned char* d = root->as_root.data;
+
+    if (is_single_root(root))
+    {
+        unsigned int cnt = root->as_root.cntt;
+        unsigned int n = len < cnt ? len : cnt;
+
+        if (dst != NULL)
+            memcpy(dst, d, n);
+        memmove(d, d + n, cnt - n);
+        root->as_root.cntt = cnt - n;
+
+        if (cnt != 0 && cnt == n)
+            on_queue_empty(root);
+        return n;
+    }
+
+    // root holds first 5 bytes, rest is in chain; take root bytes,
+    // then chain bytes, then refill root from chain
+    unsigned int k = len < ROOT_PAYLOAD ? len : ROOT_PAYLOAD;
+    if (dst != NULL)
+        memcpy(dst, d, k);
+
+    unsigned int got = k;
+    if (len > k)
+        got += take_chain(root, dst != NULL ? dst + k : NULL, len - k);
+
+    memmove(d, d + k, ROOT_PAYLOAD - k);
+    unsigned int refill = take_chain(root, d + ROOT_PAYLOAD - k, k);
+
+    if (unlikely(refill < k) && !is_single_root(root))
+    {
+        // chain stopped at spilled data it could not read, root has
+        // to stay full, so it takes back last bytes taken (NULL dst
+        // callers do not take past bytes in memory)
+        assert(dst != NULL);
+        unsigned int m = k - refill;
+        memmove(d + m, d, ROOT_PAYLOAD - m);
+        memcpy(d, dst + got - m, m);
+        return got - m;
+    }
+
+    if (is_single_root(root))
+    {
+        root->as_root.cntt = ROOT_PAYLOAD - k + refill;
+        if (is_empty_root(root))
+            on_queue_empty(root);
+    }
+
+    return got;
+}
+
+static unsigned int peek_bytes(node_t* root, unsigned char* dst, unsigned int len)
+{
+    if (is_single_root(root))
+    {
+        unsigned int n = len < root->as_root.cntt ? len : root->as_root.cntt;
+        memcpy(dst, root->as_root.data, n);
+        return n;
+    }
+
+    unsigned int got = len < ROOT_PAYLOAD ? len : ROOT_PAYLOAD;
+    memcpy(dst, root->as_root.data, got);
+
+    node_t* t = get_root_tail(root);
+    node_t* p = get_root_head(root);
+
+    for (;;)
+    {
+        unsigned char* d;
+        unsigned int cnt = chunk_bytes(root, p, &d);
+        unsigned int n = len - got < cnt ? len - got : cnt;
+
+        if (d != NULL)
+            memcpy(dst + got, d, n);
+        else if (is_spill(p) && !spill_read(dst + got, n, p->as_spill.off))
+            break;
+        else if (!is_spill(p))
+            memset(dst + got, p->as_run.b, n);
+        got += n;
+        if (got == len || p == t)
+            break;
+        p = chain_next(root, p);
+    }
+
+    return got;
+}
+
+static inline unsigned int encode_msg_len(unsigned char* hdr, unsigned int len)
+{
+    unsigned int n = 0;
+    while (len >= 0x80)
+    {
+        hdr[n++] = (len & 0x7F) | 0x80;
+        len >>= 7;
+    }
+    hdr[n++] = len;
+    return n;
+}
+
+static inline unsigned int decode_msg_len(node_t* root, unsigned int* len)
+{
+    unsigned char hdr[MSG_HEADER_MAX];
+    unsigned int cnt = peek_bytes(root, hdr, MSG_HEADER_MAX);
+    unsigned int v = 0;
+
+    for (unsigned int i = 0; i < cnt; i++)
+    {
+        v |= (unsigned int)(hdr[i] & 0x7F) << (7 * i);
+        if (!(hdr[i] & 0x80))
+        {
+            *len = v;
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+void enqueueByte(Q* q, unsigned char b)
+{
+    node_t* root = get_queue_root(q);
+
+    TRACE_BEGIN(root);
+    queueStatus_t st = enqueue_byte(root, b);
+    TRACE_END(root, QUEUE_TRACE_ENQ, st);
+
+    if (unlikely(st != QUEUE_OK))
+        onOutOfMemory();
+}
+
+unsigned char dequeueByte(Q* q)
+{
+    node_t* root = get_queue_root(q);
+    unsigned char b;
+
+    TRACE_BEGIN(root);
+    queueStatus_t st = dequeue_byte(root, &b);
+    TRACE_END(root, QUEUE_TRACE_DEQ, st);
+
+    if (unlikely(st != QUEUE_OK))
+    {
+        onIllegalOperation();
+        return 0;
+    }
+
+    return b;
+}
+
+queueStatus_t tryEnqueue(Q* q, unsigned char b)
+{
+    node_t* root = get_queue_root(q);
+
+    TRACE_BEGIN(root);
+    queueStatus_t st = enqueue_byte(root, b);
+    TRACE_END(root, QUEUE_TRACE_ENQ, st);
+    return st;
+}
+
+queueStatus_t tryDequeue(Q* q, unsigned char* b)
+{
+    assert(b != NULL);
+    node_t* root = get_queue_root(q);
+
+    TRACE_BEGIN(root);
+    queueStatus_t st = dequeue_byte(root, b);
+    TRACE_END(root, QUEUE_TRACE_DEQ, st);
+    return st;
+}
+
+int tryEnqueueBytes(Q* q, const unsigned char* src, unsigned int len)
+{
+    assert(src != NULL || len == 0);
+    node_t* root = get_queue_root(q);
+
+    TRACE_BEGIN(root);
+    unsigned int cnt = rle_enabled(root) ? nodes_needed_rle(root, 0, src, len)
+                                         : nodes_needed(root, len);
+    queueStatus_t st = make_room(root, cnt);
+    unsigned int i = 0;
+    if (likely(st == QUEUE_OK))
+    {
+        i = append_bytes(root, src, len);
+        st = i == len ? QUEUE_OK : QUEUE_OUT_OF_MEM;
+    }
+
+    // does not fit as a whole - put as much as possible
+    while (i < len && enqueue_byte(root, src[i]) == QUEUE_OK)
+        i++;
+
+    TRACE_END(root, QUEUE_TRACE_ENQ_BULK, st);
+    return i;
+}
+
+int tryDequeueBytes(Q* q, unsigned char* dst, unsigned int len)
+{
+    assert(dst != NULL || len == 0);
+    node_t* root = get_queue_root(q);
+
+    TRACE_BEGIN(root);
+    unsigned int got = dequeue_bytes(root, dst, len);
+    queueStatus_t st = got == len ? QUEUE_OK : QUEUE_EMPTY;
+
+    // nothing taken as spilled data in front could not be read
+    if (unlikely(got == 0 && len != 0) && !is_single_root(root) && is_spill_head(root))
+        st = QUEUE_IO_ERROR;
+
+    TRACE_END(root, QUEUE_TRACE_DEQ_BULK, st);
+    return st == QUEUE_IO_ERROR ? QUEUE_IO_ERROR : (int) got;
+}
+
+queueStatus_t tryEnqueueRecord(Q* q, const void* src, unsigned int size)
+{
+    assert(src != NULL);
+    return enqueue_bytes(get_queue_root(q), src, size);
+}
+
+queueStatus_t tryDequeueRecord(Q* q, void* dst, unsigned int size)
+{
+    assert(dst != NULL);
+    node_t* root = get_queue_root(q);
+
+    if (unlikely(!queue_has_bytes(root, size)))
+        return QUEUE_EMPTY;
+
+    if (unlikely(dequeue_bytes(root, dst, size) != size))
+        return QUEUE_IO_ERROR;
+    return QUEUE_OK;
+}
+
+queueStatus_t enqueueMessage(Q* q, const void* src, unsigned int len)
+{
+    assert(src != NULL || len == 0);
+    node_t* root = get_queue_root(q);
+
+    unsigned char hdr[MSG_HEADER_MAX];
+    unsigned int hlen = encode_msg_len(hdr, len);
+
+    // check whole message first, so header is never left alone
+    unsigned int cnt = rle_enabled(root) ? nodes_needed_rle(root, hlen, src, len)
+                                         : nodes_needed(root, hlen + len);
+    queueStatus_t st = make_room(root, cnt);
+    if (unlikely(st != QUEUE_OK))
+        return st;
+
+    if (unlikely(append_bytes(root, hdr, hlen) != hlen || append_bytes(root, src, len) != len))
+        return QUEUE_OUT_OF_MEM;
+    return QUEUE_OK;
+}
+
+int peekMessageLength(Q* q)
+{
+    unsigned int len;
+
+    if (decode_msg_len(get_queue_root(q), &len) == 0)
+        return QUEUE_EMPTY;
+
+    return len;
+}
+
+int dequeueMessage(Q* q, void* dst, unsigned int cap)
+{
+    node_t* root = get_queue_root(q);
+    unsigned int len;
+    unsigned int hlen = decode_msg_len(root, &len);
+
+    if (hlen == 0)
+        return QUEUE_EMPTY;
+    if (len > cap)
+        return QUEUE_TOO_SMALL;
+
+    unsigned char hdr[MSG_HEADER_MAX];
+    if (unlikely(dequeue_bytes(root, hdr, hlen) != hlen))
+        return QUEUE_IO_ERROR;
+    if (unlikely(dequeue_bytes(root, dst, len) != len))
+        return QUEUE_IO_ERROR;
+    return len;
+}
+
+// *it of nextQueueSegment after last segment, node indices are below
+#define SEGMENTS_END NODE_COUNT
+
+int nextQueueSegment(Q* q, unsigned int* it, queueSegment_t* seg)
+{
+    assert(it != NULL && seg != NULL);
+    node_t* root = get_queue_root(q);
+
+    *seg = (queueSegment_t){ 0 };
+    if (*it == QUEUE_SEGMENTS_BEGIN)
+    {
+        bool single = is_single_root(root);
+        if (is_empty_root(root))
+        {
+            *it = SEGMENTS_END;
+            return 0;
+        }
+
+        seg->data = root->as_root.data;
+        seg->len = single ? root->as_root.cntt : ROOT_PAYLOAD;
+        *it = single ? SEGMENTS_END : root->as_root.head;
+        return 1;
+    }
+
+    if (*it >= SEGMENTS_END)
+        return 0;
+
+    node_t* p = index_to_node(*it);
+    unsigned char* d;
+
+    seg->len = chunk_bytes(root, p, &d);
+    seg->data = d;
+    if (d == NULL && is_spill(p))
+        seg->spilled = 1;
+    else if (d == NULL)
+        seg->b = p->as_run.b;
+
+    *it = p == get_root_tail(root) ? SEGMENTS_END : node_to_index(chain_next(root, p));
+    return 1;
+}
+
+static unsigned int gather_iov(node_t* root, struct iovec* iov, unsigned int* cnt,
+                               unsigned char* fill, unsigned int max)
+{
+    unsigned int len = is_single_root(root) ? root->as_root.cntt : ROOT_PAYLOAD;
+
+    len = len < max ? len : max;
+    iov[0] = (struct iovec){ .iov_base = root->as_root.data, .iov_len = len };
+    *cnt = 1;
+    if (is_single_root(root))
+        return len;
+
+    // bytes written are dequeued, and root is refilled with bytes
+    // after them, so chain bytes before spilled data (mem) have to
+    // cover root too: then dequeue never has to read spilled data
+    unsigned int used = 0, mem = 0;
+    bool more = true;
+    node_t* t = get_root_tail(root);
+
+    for (node_t* p = get_root_head(root); ; p = chain_next(root, p))
+    {
+        if (is_spill(p))
         {
-            node_t* newman = alloc_node();
-            if (newman == NULL) return;
-            set_root_tail(root, newman, 0);
-            set_root_head(root, newman, 0);
-            push_tail_data(root, b);
+            len = mem < len ? mem : len;
+            break;
         }
-        return;
+
+        unsigned char* d;
+        unsigned int n = chunk_bytes(root, p, &d);
+        bool whole = true;
+        mem += n;
+        more = more && len < max && *cnt < FD_IOV;
+        n = max - len < n ? max - len : n;
+
+        if (more && d == NULL) // run, no bytes to point to
+        {
+            // run cut by fill space ends segments, bytes of next
+            // node do not follow it
+            if (FD_FILL - used < n)
+            {
+                n = FD_FILL - used;
+                whole = false;
+            }
+            memset(fill + used, p->as_run.b, n);
+            d = fill + used;
+            used += n;
+            more = n != 0;
+        }
+
+        if (more)
+        {
+            iov[(*cnt)++] = (struct iovec){ .iov_base = d, .iov_len = n };
+            len += n;
+        }
+        more = more && whole;
+        if (p == t || (!more && mem >= len))
+            break;
     }
 
+    // trim segments to len
+    unsigned int k = 0;
+    for (unsigned int sum = 0; k < *cnt && sum < len; k++)
+    {
+        if (iov[k].iov_len > len - sum)
+            iov[k].iov_len = len - sum;
+        sum += iov[k].iov_len;
+    }
+    *cnt = k != 0 ? k : 1;
 
+    return len;
+}
 
-    if (is_full_tail(root))
+int queueReadFromFd(Q* q, int fd, unsigned int max)
+{
+    node_t* root = get_queue_root(q);
+    struct iovec iov[FD_IOV];
+    node_t* nodes[FD_IOV];
+    bool held[FD_IOV]; // node was taken from reserveCapacity of queue
+    unsigned int cnt = 0, k = 0;
+    bool was_empty = is_empty_root(root);
+    root_info_t* ri = &root_info[node_to_index(root)];
+
+    if (max > INT_MAX)
+        max = INT_MAX;
+
+    // nodes are taken ahead for bytes fd has, not for max, so short
+    // read does not take (and give back) nodes it never fills
+    int avail;
+    unsigned int want = max;
+    if (ioctl(fd, FIONREAD, &avail) == 0)
+        want = avail <= 0 ? 0 : (unsigned int) avail < max ? (unsigned int) avail : max;
+    else if (max > FD_BATCH * NODE_PAYLOAD)
+        want = FD_BATCH * NODE_PAYLOAD;
+
+    // room of root or tail first, first byte of each new node is
+    // left for 8th byte of full tail, as append_tail moves it there
+    unsigned char* at = NULL;
+    unsigned int room = 0, lead = 1;
+
+    if (is_single_root(root))
     {
-        // we run out fo tail data
-        node_t* newman = alloc_node();
-        if (newman == NULL) return;
-        char old_b = swap_tail(root, newman);
-        push_tail_data2(root, old_b, b);
-        return;
+        room = ROOT_PAYLOAD - root->as_root.cntt;
+        at = root->as_root.data + root->as_root.cntt;
+        lead = 0; // first node becomes head and tail, nothing moves
+    }
+    else if (is_wide_tail(root))
+    {
+        node_t* tail = get_root_tail(root);
+        room = wide_cap(node_span(tail)) - wide_fill(tail);
+        if (tail->as_wide.end + room > node_span(tail) * sizeof(node_t) - 1)
+            compact_wide(tail);
+        at = (unsigned char*) tail + tail->as_wide.end;
+    }
+    else if (is_run_tail(root))
+    {
+        lead = 0; // run has own next field
+    }
+    else
+    {
+        room = TAIL_PAYLOAD - root->as_root.cntt;
+        at = get_root_tail(root)->as_tail.data + root->as_root.cntt;
+    }
+
+    room = room < max ? room : max;
+    if (room != 0)
+        iov[cnt++] = (struct iovec){ .iov_base = at, .iov_len = room };
+
+    // fd has nothing yet and there is no room: byte that may come is
+    // staged, so read ending with EOF or EAGAIN takes no node
+    if (want == 0 && room == 0 && max != 0)
+    {
+        if (check_queue_nodes(root, 1) == QUEUE_OK)
+        {
+            unsigned char b;
+            ssize_t got = read(fd, &b, 1);
+            if (got == 1)
+            {
+                queueStatus_t st = enqueue_byte(root, b);
+                assert(st == QUEUE_OK); // checked above
+                (void) st;
+            }
+            return got;
+        }
+        want = 1; // spills if that makes room
+    }
+
+    // then new plain nodes, ones read does not reach are freed
+    unsigned int len = room;
+    node_t* near = is_single_root(root) ? root : get_root_tail(root);
+
+    while (len < want && cnt < FD_IOV)
+    {
+        unsigned int resv = ri->resv;
+        node_t* node = alloc_queue_node(root, near, 1);
+        if (unlikely(node == NULL) && cnt == 0 && spill_queue(root))
+            node = alloc_queue_node(root, near, 1);
+        if (node == NULL)
+            break;
+
+        unsigned int n = TAIL_PAYLOAD - lead;
+        n = max - len < n ? max - len : n;
+        held[k] = ri->resv != resv;
+        nodes[k++] = node;
+        iov[cnt++] = (struct iovec){ .iov_base = node->as_tail.data + lead, .iov_len = n };
+        len += n;
+        lead = 1;
+        near = node;
+    }
 
+    if (cnt == 0)
+    {
+        if (max == 0)
+            return 0;
+        errno = ENOBUFS;
+        return -1;
     }
 
-    push_tail_data(root, b);
+    ssize_t got = readv(fd, iov, cnt);
+    unsigned int used = 0; // new nodes read put bytes to
+
+    if (got > 0)
+    {
+        unsigned int rest = got;
+        unsigned int n = rest < room ? rest : room;
+
+        if (is_wide_tail(root))
+            get_root_tail(root)->as_wide.end += n;
+        else
+            root->as_root.cntt += n;
+        rest -= n;
+
+        for (unsigned int i = cnt - k; rest != 0; i++)
+        {
+            node_t* node = nodes[used++];
+            n = rest < iov[i].iov_len ? rest : iov[i].iov_len;
+
+            if (is_single_root(root))
+            {
+                set_root_tail(root, node, 0);
+                set_root_head(root, node, 0);
+            }
+            else
+            {
+                append_tail(root, node);
+            }
+            root->as_root.cntt += n;
+            rest -= n;
+        }
+
+        if (was_empty)
+            on_queue_ready(root);
+    }
+
+    // nodes read did not reach go back where they came from,
+    // reserved ones to reservation of queue
+    while (k > used)
+    {
+        free_queue_node(root, nodes[--k]);
+        if (held[k])
+        {
+            ri->resv++;
+            arena_reserved++;
+        }
+    }
 
+    return got;
 }
 
-unsigned char dequeueByte(Q* q)
+int queueWriteToFd(Q* q, int fd, unsigned int max)
 {
     node_t* root = get_queue_root(q);
+    struct iovec iov[FD_IOV];
+    unsigned char fill[FD_FILL];
+    unsigned int done = 0;
 
-    if (is_empty_root(root))
+    if (max > INT_MAX)
+        max = INT_MAX;
+
+    // one writev per FD_IOV segments, until max or short write
+    while (done < max && !is_empty_root(root))
     {
-        onIllegalOperation();
+        if (unlikely(!is_single_root(root) && is_spill_head(root))
+            && !page_in(root, get_root_head(root), get_root_head(root)))
+        {
+            errno = EIO;
+            return done != 0 ? (int) done : -1;
+        }
+
+        unsigned int cnt;
+        unsigned int len = gather_iov(root, iov, &cnt, fill, max - done);
+        if (len == 0)
+            break;
+        ssize_t n = writev(fd, iov, cnt);
+
+        if (n < 0)
+            return done != 0 ? (int) done : -1; // error shows up on next call
+
+        dequeue_bytes(root, NULL, n);
+        done += n;
+        if ((unsigned int) n < len)
+            break;
+    }
+
+    return done;
+}
+
+// Element size specialized api, sizeof() is constant in each
+// instance, so bulk helpers inline with fixed size copies
+#define DEFINE_TYPED_API(name, type)                                \
+    queueStatus_t tryEnqueue##name(Q* q, type v)                    \
+    {                                                               \
+        return enqueue_bytes(get_queue_root(q),                     \
+                             (const unsigned char*)&v, sizeof(v));  \
+    }                                                               \
+    queueStatus_t tryDequeue##name(Q* q, type* v)                   \
+    {                                                               \
+        assert(v != NULL);                                          \
+        node_t* root = get_queue_root(q);                           \
+        if (unlikely(!queue_has_bytes(root, sizeof(*v))))           \
+            return QUEUE_EMPTY;                                     \
+        if (unlikely(dequeue_bytes(root, (unsigned char*)v,         \
+                                   sizeof(*v)) != sizeof(*v)))      \
+            return QUEUE_IO_ERROR;                                  \
+        return QUEUE_OK;                                            \
+    }
+
+DEFINE_TYPED_API(U16, uint16_t)
+DEFINE_TYPED_API(U32, uint32_t)
+DEFINE_TYPED_API(U64, uint64_t)
+
+unsigned int queueLineCrossings(Q* q)
+{
+    node_t* root = get_queue_root(q);
+
+    if (is_single_root(root))
         return 0;
+
+    node_t* t = get_root_tail(root);
+    node_t* p = get_root_head(root);
+    unsigned int line = node_to_index(root) / LINE_NODES;
+    unsigned int cnt = 0;
+
+    for (;;)
+    {
+        unsigned int l = node_to_index(p) / LINE_NODES;
+        cnt += l != line;
+        line = l;
+        if (p == t)
+            break;
+        p = chain_next(root, p);
     }
 
+    return cnt;
+}
+
+static unsigned int usage_walk(node_t* root, queueArenaStats_t* s, uint64_t* seen)
+{
+    unsigned int idx = node_to_index(root);
+    unsigned int fresh = 1;
+
+    seen[idx / 64] |= 1ull << (idx % 64);
+    s->root.nodes++;
+    s->root.slots += ROOT_PAYLOAD;
+
     if (is_single_root(root))
     {
-        return pop_single_root_data(root);
+        s->root.bytes += root->as_root.cntt;
+        return fresh;
     }
 
+    s->root.bytes += ROOT_PAYLOAD;
 
-    if (is_headtail_root(root))
+    node_t* t = get_root_tail(root);
+    for (node_t* p = get_root_head(root); ; p = chain_next(root, p))
     {
+        unsigned char* data;
+        unsigned int bytes = chunk_bytes(root, p, &data);
+        unsigned int span = chunk_span[node_to_index(p)];
+        unsigned int nodes = node_span(p);
 
-        unsigned char tail_ret = pop_tail_data(root); // pops from 8 data field
-        unsigned char ret = shift_root_data(root, tail_ret);
+        idx = node_to_index(p);
+        if (!(seen[idx / 64] & (1ull << (idx % 64))))
+            fresh += nodes;
+        seen[idx / 64] |= 1ull << (idx % 64);
 
-        if (is_empty_tail(root))
+        if (span == RUN_SPAN)
         {
-            free_node(get_root_tail(root));
-            make_root_single(root);
+            s->run_nodes++;
+            s->run_bytes += bytes;
+        }
+        else if (span == SPILL_SPAN)
+        {
+            s->spill_nodes++;
+            s->spill_bytes += bytes;
+        }
+        else
+        {
+            // chunk past tail gives its last byte to next link
+            queueNodeUsage_t* u = p == t ? &s->tail : &s->normal;
+            u->nodes += nodes;
+            u->bytes += bytes;
+            u->slots += span != 0 ? wide_cap(span) - (p != t) : p == t ? TAIL_PAYLOAD : NODE_PAYLOAD;
         }
 
-        return ret;
+        if (p == t)
+            return fresh;
     }
+}
 
-    unsigned char head_ret = pop_head_data(root);
-    unsigned char ret = shift_root_data(root, head_ret);
+void getArenaStats(Q* queues[], unsigned int n, queueArenaStats_t* s)
+{
+    assert(queues != NULL || n == 0);
+    assert(s != NULL);
 
-    if (is_empty_head(root))
+    uint64_t seen[NODE_COUNT / 64] = { 0 };
+
+    *s = (queueArenaStats_t){ 0 };
+    s->queues = n;
+    for (unsigned int i = 0; i < n; i++)
     {
-        node_t* head = get_root_head(root);
-        set_root_head(root, get_node_next(head), NODE_PAYLOAD);
-        free_node(head);
+        s->queue_nodes += usage_walk(get_queue_root(queues[i]), s, seen);
+        s->line_crossings += queueLineCrossings(queues[i]);
+    }
+
+    for (unsigned int i = buffer->as_arena.free; i != 0; i = index_to_node(i)->as_free.next)
+        s->free_nodes++;
+
+    unsigned int bump = buffer->as_arena.bump;
+    s->arena_nodes = arena_nodes;
+    s->bump_nodes = arena_nodes - bump;
+
+    // node 0 is allocated too, as arena header
+    unsigned int allocated = bump - s->free_nodes - 1;
+    s->other_nodes = allocated > s->queue_nodes ? allocated - s->queue_nodes : 0;
 
-        return ret;
+    for (unsigned int line = 0; line * LINE_NODES < bump; line++)
+    {
+        unsigned int in_bump = line * LINE_NODES + LINE_NODES > bump ? line * LINE_NODES + LINE_NODES - bump : 0;
+        unsigned int idle = __builtin_popcount(free_lines[line]) + in_bump;
+        if (idle == LINE_NODES)
+            continue;
+        s->used_lines++;
+        s->split_lines += idle != 0;
     }
+}
 
+void printArenaReport(Q* queues[], unsigned int n)
+{
+    queueArenaStats_t s;
+    uint64_t seen[NODE_COUNT / 64] = { 0 };
 
+    for (unsigned int i = 0; i < n; i++)
+    {
+        queueArenaStats_t q = { 0 };
+        usage_walk(get_queue_root(queues[i]), &q, seen);
+        printf("queue %u [%u]: %u nodes, %u bytes, %u line crossings\n", i,
+               node_to_index(get_queue_root(queues[i])),
+               q.root.nodes + q.normal.nodes + q.tail.nodes + q.run_nodes + q.spill_nodes,
+               q.root.bytes + q.normal.bytes + q.tail.bytes + q.run_bytes + q.spill_bytes,
+               queueLineCrossings(queues[i]));
+    }
 
-    return ret;
+    getArenaStats(queues, n, &s);
+
+    const char*       names[] = { "root", "normal", "tail" };
+    queueNodeUsage_t* kinds[] = { &s.root, &s.normal, &s.tail };
+    for (unsigned int k = 0; k < 3; k++)
+        printf("%-6s %4u nodes, %5u of %5u bytes used (%u%%)\n", names[k], kinds[k]->nodes,
+               kinds[k]->bytes, kinds[k]->slots, kinds[k]->slots ? kinds[k]->bytes * 100 / kinds[k]->slots : 0);
+    printf("run    %4u nodes, %5u bytes\n", s.run_nodes, s.run_bytes);
+    printf("spill  %4u nodes, %5u bytes in file\n", s.spill_nodes, s.spill_bytes);
+    printf("arena  %u nodes: %u in %u queues, %u other, %u free list, %u bump\n",
+           s.arena_nodes, s.queue_nodes, s.queues, s.other_nodes, s.free_nodes, s.bump_nodes);
+    printf("lines  %u used (%u at best), %u split with free list, %u crossings\n",
+           s.used_lines, (s.arena_nodes - s.free_nodes - s.bump_nodes + LINE_NODES - 1) / LINE_NODES,
+           s.split_lines, s.line_crossings);
 }
 
 void printQueue(Q* q)
@@ -834,6 +3884,435 @@ void printQueue(Q* q)
     printf("%d]\n", root->data );*/
 }
 
+void setQueueNotifier(Q* q, queueNotifier_t* n)
+{
+    node_t* root = get_queue_root(q);
+    root_info[node_to_index(root)].notifier = n;
+}
+
+void ackQueueNotifier(queueNotifier_t* n)
+{
+    assert(n != NULL);
+
+    if (!n->pending)
+        return;
+
+    uint64_t cnt;
+    ssize_t r = read(n->fd, &cnt, sizeof(cnt));
+    (void)r;
+    n->pending = 0;
+}
+
+queueStatus_t setQueueQuota(Q* q, unsigned int min_nodes, unsigned int max_nodes)
+{
+    node_t* root = get_queue_root(q);
+    root_info_t* ri = &root_info[node_to_index(root)];
+
+    assert(min_nodes < NODE_COUNT && max_nodes < NODE_COUNT);
+    assert(max_nodes == 0 || min_nodes <= max_nodes);
+
+    unsigned int old_resv = ri->qresv;
+    unsigned int new_resv = ri->nodes < min_nodes ? min_nodes - ri->nodes : 0;
+
+    if (new_resv > old_resv && !grow_arena(new_resv - old_resv))
+        return QUEUE_OUT_OF_MEM;
+
+    arena_reserved = arena_reserved - old_resv + new_resv;
+    ri->qresv = new_resv;
+    ri->quota_min = min_nodes;
+    ri->quota_max = max_nodes;
+    return QUEUE_OK;
+}
+
+queueStatus_t reserveCapacity(Q* q, unsigned int nbytes)
+{
+    node_t* root = get_queue_root(q);
+    root_info_t* ri = &root_info[node_to_index(root)];
+
+    unsigned int cnt = nodes_needed_any(root, nbytes);
+    unsigned int own = ri->qresv;
+    unsigned int resv = cnt > own ? cnt - own : 0;
+
+    if (ri->quota_max != 0 && ri->nodes + cnt > ri->quota_max)
+        return QUEUE_OVER_QUOTA;
+    if (ri->nodes + cnt >= NODE_COUNT)
+        return QUEUE_OUT_OF_MEM;
+
+    // spill does not change tail, so cnt stays right
+    while (resv > ri->resv && !grow_arena(resv - ri->resv))
+        if (!spill_queue(root))
+            return QUEUE_OUT_OF_MEM;
+
+    arena_reserved = arena_reserved - ri->resv + resv;
+    ri->resv = resv;
+    return QUEUE_OK;
+}
+
+void setArenaWatermarks(unsigned int low, unsigned int high,
+                        onWatermark_cb_t on_high, onWatermark_cb_t on_low)
+{
+    assert(low < high && high < NODE_COUNT);
+
+    wm_low = low;
+    wm_high = high;
+    onHighWatermark = on_high;
+    onLowWatermark = on_low;
+
+    wm_above = arena_used >= high;
+    if (wm_above && on_high != NULL)
+        on_high(arena_used);
+}
+
+void initPrioGroup(queuePrioGroup_t* g)
+{
+    assert(g != NULL);
+    memset(g, 0, sizeof(*g));
+}
+
+static inline bool is_bound_level(queuePrioGroup_t* g, unsigned int level)
+{
+    if (g->levels[level] == NULL)
+        return false;
+
+    root_info_t* ri = &root_info[node_to_index(get_queue_root(g->levels[level]))];
+    return ri->group == g && ri->level == level && ri->gen == arena_gen;
+}
+
+void bindPrioQueue(queuePrioGroup_t* g, unsigned int level, Q* q)
+{
+    assert(g != NULL);
+    assert(level < QUEUE_PRIO_LEVELS);
+
+    if (is_bound_level(g, level))
+        root_info[node_to_index(get_queue_root(g->levels[level]))].group = NULL;
+
+    g->levels[level] = q;
+    g->ready &= ~(1ull << level);
+
+    if (q == NULL)
+        return;
+
+    node_t* root = get_queue_root(q);
+    root_info_t* ri = &root_info[node_to_index(root)];
+
+    if (ri->group != NULL) // queue can be bound to one level only
+        bindPrioQueue(ri->group, ri->level, NULL);
+
+    ri->group = g;
+    ri->level = level;
+    ri->gen = arena_gen;
+
+    if (!is_empty_root(root))
+        g->ready |= 1ull << level;
+}
+
+int dequeueHighest(queuePrioGroup_t* g, unsigned char* b)
+{
+    assert(g != NULL && b != NULL);
+
+    if (g->ready == 0)
+        return QUEUE_EMPTY;
+
+    unsigned int level = __builtin_ctzll(g->ready);
+    while (unlikely(!is_bound_level(g, level))) // left from before resetArena
+    {
+        g->levels[level] = NULL;
+        g->ready &= ~(1ull << level);
+        if (g->ready == 0)
+            return QUEUE_EMPTY;
+        level = __builtin_ctzll(g->ready);
+    }
+
+    queueStatus_t st = dequeue_byte(get_queue_root(g->levels[level]), b);
+    if (unlikely(st != QUEUE_OK)) // ready queue is never empty
+        return st;
+
+    return level;
+}
+
+Q* nextReadyQueue(unsigned int* it)
+{
+    assert(it != NULL);
+
+    unsigned int idx = *it < NODE_COUNT ? find_ready(*it) : 0;
+    if (idx == 0)
+    {
+        *it = NODE_COUNT;
+        return NULL;
+    }
+
+    *it = idx + 1;
+    return get_queue_handle(index_to_node(idx));
+}
+
+Q* pollReadyQueue(unsigned int* cursor)
+{
+    assert(cursor != NULL);
+
+    unsigned int idx = *cursor < NODE_COUNT ? find_ready(*cursor) : 0;
+    if (idx == 0)
+        idx = find_ready(0); // wrap around
+    if (idx == 0)
+        return NULL;
+
+    *cursor = idx + 1;
+    return get_queue_handle(index_to_node(idx));
+}
+
+unsigned int countReadyQueues()
+{
+    unsigned int cnt = 0;
+    for (unsigned int w = 0; w < NODE_COUNT / 64; w++)
+        cnt += __builtin_popcountll(ready_set[w]);
+    return cnt;
+}
+
+void setQueueFlags(Q* q, unsigned int flags)
+{
+    node_t* root = get_queue_root(q);
+    root_info[node_to_index(root)].flags = flags;
+}
+
+void setAllocPolicy(queueAllocPolicy_t policy)
+{
+    alloc_policy = policy;
+}
+
+void setSegmentProvider(queueSegmentAlloc_cb_t alloc, queueSegmentFree_cb_t release)
+{
+    onSegmentAlloc = alloc;
+    onSegmentFree = release;
+}
+
+unsigned int releaseArenaSegments()
+{
+    unsigned int cnt = 0;
+
+    while (arena_nodes > buffer_nodes && arena_free() >= arena_reserved + SEG_NODES)
+    {
+        unsigned int first = arena_nodes - SEG_NODES;
+        unsigned int bump = buffer->as_arena.bump;
+        unsigned int end = bump < arena_nodes ? bump : arena_nodes;
+
+        // nodes below bump have to be on free list
+        for (unsigned int i = first; i < end; i++)
+            if (!(free_lines[i / LINE_NODES] & (1u << (i % LINE_NODES))))
+                return cnt;
+
+        for (unsigned int i = first; i < end; i++)
+            unlink_free(i);
+        if (bump > first)
+            buffer->as_arena.bump = first;
+
+        node_t* seg = seg_base[first / SEG_NODES];
+        seg_base[first / SEG_NODES] = NULL;
+        arena_nodes = first;
+        if (onSegmentFree != NULL)
+            onSegmentFree((unsigned char*) seg);
+        cnt++;
+    }
+
+    return cnt;
+}
+
+void setSpillFile(int fd)
+{
+    spill_fd = fd;
+    spill_end = fd >= 0 ? lseek(fd, 0, SEEK_END) : 0;
+    if (spill_end < 0) // not seekable, spilling would fail anyway
+        spill_fd = -1;
+}
+
+#ifdef QUEUE_TRACE
+int queueTraceDump(int fd)
+{
+    unsigned int n = trace_cnt < QUEUE_TRACE_SIZE ? trace_cnt : QUEUE_TRACE_SIZE;
+    queueTraceHeader_t h = {
+        .magic = { 'Q', 'T', 'R', 'C' },
+        .version = 1,
+        .event_size = sizeof(queueTraceEvent_t),
+        .count = n,
+        .lost = trace_cnt - n,
+        .tsc_base = trace_tsc_base,
+        .ns_base = trace_ns_base,
+        .tsc_dump = trace_clock(),
+        .ns_dump = trace_ns(),
+    };
+
+    // oldest events are at write position once ring wrapped
+    unsigned int at = (trace_cnt - n) % QUEUE_TRACE_SIZE;
+    unsigned int first = n < QUEUE_TRACE_SIZE - at ? n : QUEUE_TRACE_SIZE - at;
+    const void* part[] = { &h, trace_ring + at, trace_ring };
+    size_t size[] = { sizeof(h), first * sizeof(queueTraceEvent_t),
+                      (n - first) * sizeof(queueTraceEvent_t) };
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        const unsigned char* p = part[i];
+        for (size_t left = size[i]; left != 0; )
+        {
+            ssize_t w = write(fd, p, left);
+            if (w <= 0)
+                return -1;
+            p += w;
+            left -= w;
+        }
+    }
+    return n;
+}
+#endif
+
+bool compactArena(Q* queues[], unsigned int n)
+{
+    assert(queues != NULL || n == 0);
+
+    // shared nodes would be laid out once per queue
+    if (shared_nodes != 0 || clone_links != 0)
+        return false;
+
+    // queue left out would be overwritten, so queues must hold each
+    // live root once and their nodes must be all nodes allocated
+    uint64_t seen[NODE_COUNT / 64] = { 0 };
+    unsigned int nodes = 0;
+    bool twice = false;
+    for (unsigned int i = 0; i < n && !twice; i++)
+    {
+        unsigned int idx = node_to_index(get_queue_root(queues[i]));
+        twice = seen[idx / 64] & (1ull << (idx % 64));
+        seen[idx / 64] |= 1ull << (idx % 64);
+        nodes += 1 + root_info[idx].nodes;
+    }
+    if (unlikely(twice || nodes != arena_used))
+    {
+        if (onIllegalOperation != NULL)
+            onIllegalOperation();
+        return false;
+    }
+
+    // work from copy of old state, new layout is written in place
+    node_t        old[NODE_COUNT];
+    root_info_t   old_info[NODE_COUNT];
+    uint64_t      old_ready[NODE_COUNT / 64];
+    unsigned char old_span[NODE_COUNT];
+
+    // wide chunks are packed after line 0 (segment 0 if there are
+    // extents), largest first, so they stay aligned without gaps; plain
+    // nodes fill room before them and go after them
+    unsigned int wide_at[WIDE_EXT + 1] = { 0 };
+    unsigned int plain = 1;
+
+    // side tables past bump are stale
+    for (unsigned int i = 0; i < buffer->as_arena.bump; i++)
+        if (chunk_span[i] > SPILL_SPAN)
+            wide_at[chunk_span[i]] += chunk_span[i];
+
+    unsigned int start = wide_at[WIDE_EXT] + wide_at[WIDE_EXT / 2] != 0 ? SEG_NODES : LINE_NODES;
+    unsigned int wide_end = start;
+    for (unsigned int span = WIDE_EXT; span >= WIDE_MIN; span /= 2)
+    {
+        unsigned int total = wide_at[span];
+        wide_at[span] = wide_end;
+        wide_end += total;
+    }
+    wide_at[1] = wide_end;
+
+    // layout has to fit, it may not if alignment wasted room
+    unsigned int used_plain = 1 + arena_used - (wide_end - start);
+    unsigned int bump = used_plain <= start ? (wide_end != start ? wide_end : used_plain)
+                                            : wide_end + used_plain - start;
+    if (bump > arena_nodes)
+        return false;
+
+    for (unsigned int s = 0; s < arena_nodes / SEG_NODES; s++)
+        memcpy(old + s * SEG_NODES, index_to_node(s * SEG_NODES), QUEUE_SEGMENT_SIZE);
+    memcpy(old_info, root_info, sizeof(old_info));
+    memcpy(old_ready, ready_set, sizeof(old_ready));
+    memcpy(old_span, chunk_span, sizeof(old_span));
+    memset(ready_set, 0, sizeof(ready_set));
+    memset(chunk_span, 0, sizeof(chunk_span));
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        unsigned int ri = node_to_index(get_queue_root(queues[i]));
+        if (plain == start)
+            plain = wide_at[1];
+        unsigned int r = plain++;
+        node_t* root = index_to_node(r);
+
+        *root = old[ri];
+        root_info[r] = old_info[ri];
+
+        if (old_ready[ri / 64] & (1ull << (ri % 64)))
+            ready_set[r / 64] |= 1ull << (r % 64);
+
+        queues[i] = get_queue_handle(root);
+        if (root_info[r].group != NULL)
+            root_info[r].group->levels[root_info[r].level] = queues[i];
+
+        if (is_single_root(root))
+            continue;
+
+        // lay chain out in order
+        unsigned int p = old[ri].as_root.head;
+        unsigned int t = old[ri].as_root.tail;
+        node_t* prev = NULL;
+
+        for (;;)
+        {
+            unsigned int span = old_span[p] > SPILL_SPAN ? old_span[p] : 1;
+            unsigned int dst;
+
+            if (span != 1)
+            {
+                dst = wide_at[span];
+                wide_at[span] += span;
+            }
+            else
+            {
+                if (plain == start)
+                    plain = wide_at[1];
+                dst = plain++;
+            }
+
+            node_t* node = index_to_node(dst);
+            memcpy(node, &old[p], span * sizeof(node_t));
+            chunk_span[dst] = old_span[p];
+
+            if (prev == NULL)
+                root->as_root.head = dst;
+            else
+                set_node_next(prev, node);
+            prev = node;
+
+            if (p == t)
+                break;
+            p = ((unsigned char*) &old[p])[span * sizeof(node_t) - 1];
+        }
+        root->as_root.tail = node_to_index(prev);
+    }
+
+    // all queues have to be passed, otherwise their nodes are lost
+    unsigned int gaps = 0;
+    if (plain < wide_end && wide_end > start)
+        gaps = start - plain;
+    else
+        assert(bump == plain);
+    assert(bump - 1 - gaps == arena_used);
+
+    // the rest is single bump region, unused room before wide chunks goes to free list
+    buffer->as_arena.free = 0;
+    buffer->as_arena.bump = bump;
+    memset(free_lines, 0, sizeof(free_lines));
+
+    for (unsigned int i = 0; i < gaps; i++)
+    {
+        memset(index_to_node(plain + i), 0, sizeof(node_t));
+        push_free(plain + i);
+    }
+
+    return true;
+}
+
 void setOutOfMemoryCallback(onOutOfMem_cb_t cb)
 {
     assert(cb != NULL);
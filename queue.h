@@ -22,6 +22,12 @@
 #ifndef QUEUE_H
 #define QUEUE_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 typedef long Q; // TODO: how to forward declare node_t here? may shoot foot as is
 
@@ -37,12 +43,51 @@ typedef struct
     int max_els_in_single_with_63_empty; // if I create 63 empty queues and one work queue and put all data to 64th work queue - how many bytes will that be?
 } queueMetrics_t;
 
+// Status codes of try* api, errors are negative
+typedef enum
+{
+    QUEUE_OK         =  0,
+    QUEUE_OUT_OF_MEM = -1, // no free node for new data
+    QUEUE_EMPTY      = -2, // nothing to dequeue
+    QUEUE_OVER_QUOTA = -3, // queue reached its max nodes quota
+    QUEUE_TOO_SMALL  = -4, // destination buffer can not hold message
+    QUEUE_IO_ERROR   = -5, // spilled data could not be read, it stays in queue
+} queueStatus_t;
+
+// Queue flags
+#define QUEUE_FLAG_RLE 0x01 // store runs of same byte as (byte, count) nodes
+
+// Node placement policies
+typedef enum
+{
+    QUEUE_ALLOC_LIFO,      // last freed node first
+    QUEUE_ALLOC_NEAR_TAIL, // free node in cache line of queue's tail first (default)
+} queueAllocPolicy_t;
+
+#define QUEUE_PRIO_LEVELS 64
+
+typedef struct
+{
+    uint64_t ready;                     // bit per level with non-empty queue
+    Q*       levels[QUEUE_PRIO_LEVELS]; // level 0 is the highest priority
+} queuePrioGroup_t;
+
+typedef struct
+{
+    int      fd;      // eventfd (or any fd accepting 8 byte writes), owned by caller
+    int      pending; // non zero when fd was signalled and not acked yet
+} queueNotifier_t;
+
 
 /*
  * Sets buffer to work with and inits library,
  * returs nubmer of elements max capacity
- * zeros out buffer with memset
- * Complexity: O(n) on len (memset)
+ * buffer is not zeroed here, nodes and their side table
+ * entries are zeroed lazily as bump allocator hands them out
+ * len is multiple of QUEUE_SEGMENT_SIZE up to 2048, smaller
+ * buffer grows with segment provider, metrics are for 2048;
+ * segments attached to previous arena are released
+ * Complexity: O(1) on len, only free/ready bitmaps are cleared
  */
 queueMetrics_t initQueues(unsigned char* buffer, unsigned int len);
 
@@ -51,11 +96,20 @@ queueMetrics_t initQueues(unsigned char* buffer, unsigned int len);
  *     Creates a FIFO byte queue,
  * returns a handle to it.
  *
- * Complexity: O(1) worst case
+ * Complexity: O(1), plus segment provider call if arena is full
  */
 Q* createQueue();
 
 
+/*
+ *     Non-fatal variant of createQueue, onOutOfMemory
+ * is never called, NULL is returned if arena is out of nodes.
+ *
+ * Complexity: O(1), plus segment provider call if arena is full
+ */
+Q* tryCreateQueue();
+
+
 /*
  *     Destroy an earlier created byte queue.
  * If queue has data, it gets deallocated.
@@ -67,6 +121,49 @@ Q* createQueue();
 void destroyQueue(Q* q);
 
 
+/*
+ *     Destroys n queues at once. If they hold all allocated
+ * nodes of arena (whole batch of queues is dropped), chains are
+ * not walked, arena is reset as resetArena does; otherwise they
+ * are destroyed one by one.
+ *
+ * Complexity: O(n) if queues hold whole arena, O(elements) otherwise
+ */
+void destroyQueues(Q* queues[], unsigned int n);
+
+
+/*
+ *     Drops all queues at once, arena gets state initQueues leaves
+ * it in, attached segments stay attached. Memory is not zeroed,
+ * nodes are zeroed as bump region hands them out again. All Q*
+ * handles become invalid; returned arena generation changes on
+ * every reset, so handles kept elsewhere can be tagged with it.
+ * Priority groups are not touched: levels bound before reset
+ * keep old handles, unbinding them does not affect queues created
+ * after reset and dequeueHighest drops them, so groups can be
+ * reused without unbinding first.
+ *
+ * Complexity: O(1) on arena size
+ */
+unsigned int resetArena();
+
+
+/*
+ *     Creates a queue holding same bytes as q, which then
+ * goes on on its own. Nodes of q are shared, not copied,
+ * only root and q's tail are (or nodes q got after it was
+ * cloned itself), so fan-out to N consumers costs about
+ * memory of one queue until they drain it; shared nodes
+ * are read in place and freed by last queue holding them.
+ * Returns NULL if arena has no room for copies or q holds
+ * spilled data. compactArena does nothing while nodes are
+ * shared.
+ *
+ * Complexity: O(n) on number of elements in q
+ */
+Q* cloneQueue(Q* q);
+
+
 /*
  *     Adds a new byte to a queue.
  * Q* q must be value returned by createQueue,
@@ -74,7 +171,9 @@ void destroyQueue(Q* q);
  *     May call onOutOfMemory if buffer
  * capacity is exeded.
  *
- * Complexity: O(1) worst case
+ * Complexity: O(1) on plain nodes; worst case linear on arena
+ * size (wide chunk looking for aligned room, spill), plus segment
+ * provider call if arena is full
  */
 void enqueueByte(Q* q, unsigned char b);
 
@@ -86,20 +185,216 @@ void enqueueByte(Q* q, unsigned char b);
  *     May call onIllegalOperation if called
  * on empty queue.
  *
- * Complexity: O(1) worst case
+ * Complexity: O(1) on plain nodes, plus pread of up to 32
+ * nodes when spilled data is paged in
  */
 unsigned char dequeueByte(Q* q);
 
 
+/*
+ *     Non-fatal variant of enqueueByte, onOutOfMemory
+ * is never called, QUEUE_OUT_OF_MEM or QUEUE_OVER_QUOTA
+ * is returned instead and queue is left unchanged.
+ *
+ * Complexity: as enqueueByte
+ */
+queueStatus_t tryEnqueue(Q* q, unsigned char b);
+
+
+/*
+ *     Non-fatal variant of dequeueByte, onIllegalOperation
+ * is never called, QUEUE_EMPTY is returned on empty queue and
+ * QUEUE_IO_ERROR if next byte is spilled and could not be read
+ * back (queue is unchanged, call can be retried). Byte is stored
+ * to *b on success.
+ *
+ * Complexity: as dequeueByte
+ */
+queueStatus_t tryDequeue(Q* q, unsigned char* b);
+
+
+/*
+ *     Bulk variants of tryEnqueue/tryDequeue, return number of
+ * bytes transferred, which is less than len if memory ended up,
+ * queue got empty or spilled data could not be read back; dequeue
+ * returns QUEUE_IO_ERROR if it could not take any byte for that.
+ * Bytes transferred stay transferred.
+ *
+ * Complexity: O(len)
+ */
+int tryEnqueueBytes(Q* q, const unsigned char* src, unsigned int len);
+int tryDequeueBytes(Q* q, unsigned char* dst, unsigned int len);
+
+
+/*
+ *     Fixed width element api. Record is enqueued as a whole
+ * or not at all (queue is unchanged on error), dequeue returns
+ * QUEUE_EMPTY if queue has less bytes than record size, or
+ * QUEUE_IO_ERROR if spilled part of record could not be read back
+ * (part of record before it is taken then). Data is
+ * copied in node sized chunks, not byte by byte. Typed variants
+ * store values in native byte order.
+ *
+ * Complexity: O(size) worst case
+ */
+queueStatus_t tryEnqueueRecord(Q* q, const void* src, unsigned int size);
+queueStatus_t tryDequeueRecord(Q* q, void* dst, unsigned int size);
+
+#define QUEUE_TYPED_API(name, type)                 \
+    queueStatus_t tryEnqueue##name(Q* q, type v);   \
+    queueStatus_t tryDequeue##name(Q* q, type* v);
+
+QUEUE_TYPED_API(U16, uint16_t)
+QUEUE_TYPED_API(U32, uint32_t)
+QUEUE_TYPED_API(U64, uint64_t)
+
+
+/*
+ *     Message api. Message is stored as varint length header
+ * and payload, enqueue puts whole message or nothing.
+ * Queue used for messages should not be used by byte api.
+ *     peekMessageLength returns length of next message or
+ * QUEUE_EMPTY. dequeueMessage copies next message to dst and
+ * returns its length, QUEUE_EMPTY if there is no message, or
+ * QUEUE_TOO_SMALL if it is longer than cap - message stays
+ * in queue then. QUEUE_IO_ERROR is returned if spilled part of
+ * message could not be read back, as for records.
+ *
+ * Complexity: O(len) worst case
+ */
+queueStatus_t enqueueMessage(Q* q, const void* src, unsigned int len);
+int peekMessageLength(Q* q);
+int dequeueMessage(Q* q, void* dst, unsigned int cap);
+
+
+typedef struct
+{
+    const unsigned char* data;    // bytes of segment, NULL for run and spilled data
+    unsigned int         len;     // number of bytes
+    unsigned char        b;       // data is NULL and not spilled: byte repeated len times
+    unsigned char        spilled; // len bytes are in spill file
+} queueSegment_t;
+
+#define QUEUE_SEGMENTS_BEGIN 0 // *it of first nextQueueSegment call
+
+/*
+ *     Walks data of queue in order without dequeuing it, one
+ * segment of contiguous bytes (root, node, wide chunk) per call.
+ * *it must be QUEUE_SEGMENTS_BEGIN for first call, returns 0
+ * after last segment. Data pointers are valid and walk can go
+ * on only while queue is not changed.
+ *
+ * Complexity: O(1) per segment
+ */
+int nextQueueSegment(Q* q, unsigned int* it, queueSegment_t* seg);
+
+
+/*
+ *     Fd io without staging buffer. queueReadFromFd does one readv
+ * of up to max bytes straight into room of root or tail and into
+ * new nodes (up to about 450 bytes per call), taking nodes for as
+ * many bytes as FIONREAD says fd has (about 56 if fd does not
+ * support it); nodes read did not fill are given back. queueWriteToFd writevs up to max bytes from
+ * root and nodes in place and drops what fd took, until max or
+ * short write or spilled data that can not be read back (errno is
+ * EIO then). Both return bytes moved, 0 on end of file or empty
+ * queue, -1 with errno on fd error before any byte moved; read
+ * sets errno to ENOBUFS if queue can not take a byte (out of
+ * memory or over quota). Works with non-blocking fds.
+ *
+ * Complexity: O(max) plus a syscall per about 64 nodes
+ */
+int queueReadFromFd(Q* q, int fd, unsigned int max);
+int queueWriteToFd(Q* q, int fd, unsigned int max);
+
+
+/*
+ *     Priority group of up to 64 queues, each bound to its level.
+ * Group tracks non-empty levels itself, so dequeueHighest pops
+ * byte from highest priority (lowest level) non-empty queue
+ * and returns its level, or QUEUE_EMPTY if all are empty
+ * (QUEUE_IO_ERROR as tryDequeue).
+ *     Queue can be bound to one group level at a time, binding
+ * NULL unbinds level, destroyQueue unbinds queue too.
+ *
+ * Complexity: O(1) worst case
+ */
+void initPrioGroup(queuePrioGroup_t* g);
+void bindPrioQueue(queuePrioGroup_t* g, unsigned int level, Q* q);
+int dequeueHighest(queuePrioGroup_t* g, unsigned char* b);
+
+
+/*
+ *     Readiness set of whole arena, lets to find non-empty queues
+ * without probing every queue. nextReadyQueue iterates non-empty
+ * queues, *it should be 0 at start, returns NULL at the end.
+ * pollReadyQueue is round robin: returns next non-empty queue after
+ * one returned previously with same cursor (start with 0), wrapping
+ * around, NULL if all queues are empty.
+ *
+ * Complexity: O(1) worst case (scans 256 bit set)
+ */
+Q* nextReadyQueue(unsigned int* it);
+Q* pollReadyQueue(unsigned int* cursor);
+unsigned int countReadyQueues();
+
+
+/*
+ *     Sets node quota of queue. min_nodes data nodes get reserved
+ * for queue, so other queues can not starve it, max_nodes limits
+ * number of data nodes queue can hold (0 - no limit). Root node
+ * is not counted, node holds 7 bytes.
+ *     Enqueue over the limit fails with QUEUE_OVER_QUOTA (or calls
+ * onOutOfMemory). Returns QUEUE_OUT_OF_MEM if there is not enough
+ * unreserved free nodes to reserve min_nodes.
+ *
+ * Complexity: O(1) worst case
+ */
+queueStatus_t setQueueQuota(Q* q, unsigned int min_nodes, unsigned int max_nodes);
+
+/*
+ *     Reserves nodes for next nbytes enqueued to q, counted from
+ * its current state, so enqueues of up to nbytes in total (byte
+ * or bulk, in any split, before anything is dequeued from q) do
+ * not fail for lack of memory. Reservation replaces previous one
+ * of q, nbytes 0 releases it; it shrinks as q takes nodes and is
+ * released by destroyQueue. Returns QUEUE_OUT_OF_MEM or
+ * QUEUE_OVER_QUOTA, keeping previous reservation, if nodes can
+ * not be reserved.
+ *
+ * Complexity: O(1) worst case; spill is O(n) on queue's nodes
+ */
+queueStatus_t reserveCapacity(Q* q, unsigned int nbytes);
+
+
 // Callback types
 typedef void (*onOutOfMem_cb_t)();
 typedef void (*onIllegalOperation_cb_t)();
+typedef void (*onWatermark_cb_t)(unsigned int used_nodes);
+
+// Arena segment provider: returns QUEUE_SEGMENT_SIZE bytes (64 byte
+// aligned for cache line placement) or NULL; release takes them back
+#define QUEUE_SEGMENT_SIZE 256
+typedef unsigned char* (*queueSegmentAlloc_cb_t)();
+typedef void (*queueSegmentFree_cb_t)(unsigned char* segment);
+
+/*
+ *     Sets arena watermarks in nodes (arena has 255 nodes).
+ * on_high is called when number of allocated nodes reaches high,
+ * on_low when it goes back down to low, so producers may throttle
+ * before memory ends up. If arena is above high already, on_high
+ * is called right away. Hooks may be NULL. Wide chunks move node count
+ * by up to 32 at once, so hooks get count right after it crossed the mark.
+ */
+void setArenaWatermarks(unsigned int low, unsigned int high,
+                        onWatermark_cb_t on_high, onWatermark_cb_t on_low);
 
 /*
 *     Sets outOfMemory callback.
 * When createQueue/enqueByte is unable to satisfy
 * a request due to lack of memory this callback
-* will be called, which should not return
+* will be called, which should not return.
+* Use try* api to get status instead.
 */
 void setOutOfMemoryCallback(onOutOfMem_cb_t cb);
 
@@ -107,10 +402,100 @@ void setOutOfMemoryCallback(onOutOfMem_cb_t cb);
 *     Sets onIllegalOperation callback.
 * When illegal request, like attempting to
 * dequeue a byte from an empty queue this
-* callback will be called, which should not return
+* callback will be called, which should not return.
+* Use try* api to get status instead.
 */
 void setIllegalOperationCallback(onIllegalOperation_cb_t cb);
 
+/*
+ *     Attaches readiness notifier to queue. Notifier's fd gets
+ * written with 1 when queue goes from empty to non-empty state.
+ * Same notifier may be attached to a group of queues.
+ *     Wakeups are coalesced: once fd is signalled no more writes
+ * happen until ackQueueNotifier is called, so burst of bytes or
+ * many queues of a group becoming ready cost single syscall.
+ * Passing NULL detaches notifier.
+ *
+ * Complexity: O(1) worst case
+ */
+void setQueueNotifier(Q* q, queueNotifier_t* n);
+
+/*
+ *     Consumes pending fd counter and re-arms notifier.
+ * Should be called on wakeup before draining queues,
+ * otherwise transitions happened while draining may be lost.
+ *
+ * Complexity: O(1) worst case
+ */
+void ackQueueNotifier(queueNotifier_t* n);
+
+/*
+ *     Sets queue flags (QUEUE_FLAG_*). With QUEUE_FLAG_RLE tail node
+ * that fills up with same byte becomes run node, holding up to 65535
+ * copies of it in one node; dequeue expands runs transparently. Without
+ * it capacity is exactly what queueMetrics_t reports.
+ *
+ * Complexity: O(1) worst case
+ */
+void setQueueFlags(Q* q, unsigned int flags);
+
+/*
+ *     Sets node placement policy for new data nodes of queues,
+ * with QUEUE_ALLOC_NEAR_TAIL consecutive nodes of queue tend to
+ * share cache lines even after long churn.
+ *
+ * Complexity: O(1) worst case
+ */
+void setAllocPolicy(queueAllocPolicy_t policy);
+
+/*
+ *     Sets spill file, fd < 0 turns spilling off (default). When queue
+ * can not get a node, nodes between its head and tail are appended to
+ * the file (opened for reading and writing, seekable) and read back as
+ * head gets to them, so enqueue fails only if queue's head, tail and
+ * few nodes do not fit. File must not change while queues hold spilled
+ * data; file space is not reused, so set it again to truncate it. If
+ * read back fails, data stays spilled and try* dequeue returns
+ * QUEUE_IO_ERROR, dequeueByte calls onIllegalOperation.
+ *
+ * Complexity: O(1) worst case; spill is O(n) on queue's nodes
+ */
+void setSpillFile(int fd);
+
+/*
+ *     Sets arena segment provider. When initQueues buffer has no nodes
+ * left, alloc is called for more (up to 2048 bytes of arena in total)
+ * before out of memory is reported. release may be NULL.
+ *
+ * Complexity: O(1) worst case
+ */
+void setSegmentProvider(queueSegmentAlloc_cb_t alloc, queueSegmentFree_cb_t release);
+
+/*
+ *     Gives free segments at the end of arena back to provider,
+ * returns number of segments released. Only nodes of whole free
+ * top segments can go, call compactArena first to pack nodes
+ * into low segments.
+ *
+ * Complexity: O(n) on arena size
+ */
+unsigned int releaseArenaSegments();
+
+/*
+ *     Defragments arena: each queue's nodes are laid out
+ * contiguously in FIFO order, all free nodes become single
+ * bump region. Root nodes move too, so queues must contain
+ * ALL live queues, on return it holds their new handles in
+ * same order, old handles become invalid. Priority groups
+ * are updated by library. If queues does not hold every live
+ * queue exactly once, nothing is moved, onIllegalOperation is
+ * called and false is returned. Returns false without moving
+ * anything too if nodes are shared or layout does not fit arena.
+ *
+ * Complexity: O(n) on arena size
+ */
+bool compactArena(Q* queues[], unsigned int n);
+
 ///////////////// non-mandotory api ///////////////////////////////////////////////
 
 /*
@@ -124,4 +509,241 @@ void setIllegalOperationCallback(onIllegalOperation_cb_t cb);
 void printQueue(Q* q);
 
 
+/*
+ *     Debug helper, returns number of times walk over queue's
+ * nodes (root, head, ..., tail) moves to another cache line.
+ *
+ * Complexity: O(n) on number of elements is q
+ */
+unsigned int queueLineCrossings(Q* q);
+
+
+typedef struct
+{
+    unsigned int nodes; // nodes of this kind, wide chunk counts all of its nodes
+    unsigned int bytes; // payload bytes they hold
+    unsigned int slots; // payload bytes they can hold
+} queueNodeUsage_t;
+
+typedef struct
+{
+    unsigned int     queues;         // queues walked
+    queueNodeUsage_t root;           // root nodes
+    queueNodeUsage_t normal;         // data nodes before tail, plain and wide
+    queueNodeUsage_t tail;           // tail nodes, plain and wide
+    unsigned int     run_nodes;      // run nodes and bytes of their runs
+    unsigned int     run_bytes;
+    unsigned int     spill_nodes;    // spill nodes and bytes they keep in file
+    unsigned int     spill_bytes;
+    unsigned int     arena_nodes;    // nodes in arena, node 0 included
+    unsigned int     queue_nodes;    // nodes of walked queues, shared ones once
+    unsigned int     free_nodes;     // nodes in free list
+    unsigned int     bump_nodes;     // never allocated nodes, from bump on
+    unsigned int     other_nodes;    // allocated, but not in walked queues
+    unsigned int     used_lines;     // cache lines holding allocated nodes
+    unsigned int     split_lines;    // used lines holding free list nodes too
+    unsigned int     line_crossings; // queueLineCrossings of walked queues
+} queueArenaStats_t;
+
+/*
+ *     Debug helper, walks given queues and free list of arena and
+ * fills s with node counts, payload bytes used vs slots per node
+ * kind and how allocated nodes are spread over cache lines.
+ * Nodes of queues not in queues[] show up as other_nodes.
+ *
+ * Complexity: O(n) on arena size
+ */
+void getArenaStats(Q* queues[], unsigned int n, queueArenaStats_t* s);
+
+/*
+ *     Debug helper, prints nodes, bytes and line crossings of each of
+ * given queues and getArenaStats totals to stdout. Same report is
+ * printed by queue-arena command of gdb-print-node.py.
+ *
+ * Complexity: O(n) on arena size
+ */
+void printArenaReport(Q* queues[], unsigned int n);
+
+
+///////////////// trace build /////////////////////////////////////////////////////
+
+#ifdef QUEUE_TRACE
+
+/*
+ *     Optional trace build, QUEUE_TRACE has to be defined for
+ * queue.c. Byte and bulk enqueue/dequeue calls record event to
+ * ring of QUEUE_TRACE_SIZE events (power of 2), oldest events
+ * are overwritten. Event has op, root index, path (shape of root
+ * before call, or alloc/free if call took or gave back nodes),
+ * status, TSC (clock_gettime ns where there is no TSC) at start
+ * and ticks taken. initQueues clears ring.
+ */
+#ifndef QUEUE_TRACE_SIZE
+#define QUEUE_TRACE_SIZE 4096
+#endif
+
+#define QUEUE_TRACE_ENQ      0 // enqueueByte, tryEnqueue
+#define QUEUE_TRACE_DEQ      1 // dequeueByte, tryDequeue
+#define QUEUE_TRACE_ENQ_BULK 2 // tryEnqueueBytes
+#define QUEUE_TRACE_DEQ_BULK 3 // tryDequeueBytes
+
+#define QUEUE_TRACE_SINGLE   0 // data in root only
+#define QUEUE_TRACE_HEADTAIL 1 // one data node
+#define QUEUE_TRACE_CHAIN    2 // head and tail differ
+#define QUEUE_TRACE_ALLOC    3 // nodes were allocated
+#define QUEUE_TRACE_FREE     4 // nodes were freed
+
+typedef struct
+{
+    uint64_t tsc;    // at start of call
+    uint32_t ticks;  // taken by call
+    uint8_t  op;     // QUEUE_TRACE_ENQ...
+    uint8_t  root;   // index of root node
+    uint8_t  path;   // QUEUE_TRACE_SINGLE...
+    int8_t   status; // queueStatus_t, bytes done for bulk are not kept
+} queueTraceEvent_t;
+
+// dump header, all little endian, events follow oldest first
+typedef struct
+{
+    char     magic[4];   // "QTRC"
+    uint16_t version;    // 1
+    uint16_t event_size; // sizeof(queueTraceEvent_t)
+    uint32_t count;      // number of events
+    uint32_t lost;       // events overwritten before dump
+    uint64_t tsc_base;   // clock pair at initQueues and at dump,
+    uint64_t ns_base;    // for ticks to ns conversion
+    uint64_t tsc_dump;
+    uint64_t ns_dump;
+} queueTraceHeader_t;
+
+/*
+ *     Writes trace ring to fd: queueTraceHeader_t, then events.
+ * Returns number of events written, -1 on write error.
+ *
+ * Complexity: O(n) on QUEUE_TRACE_SIZE
+ */
+int queueTraceDump(int fd);
+
+#endif // QUEUE_TRACE
+
+
+///////////////// inline build ////////////////////////////////////////////////////
+
+#ifdef QUEUE_INLINE
+
+/*
+ *     Optional inline build, QUEUE_INLINE has to be defined for
+ * queue.c and for callers. *Inline variants below do common case
+ * of byte enqueue/dequeue (room in root or plain tail, more than
+ * one byte in root or plain head) in caller's code, everything
+ * else (allocation, empty <-> non-empty transitions, errors, wide,
+ * run and shared nodes, nodes outside of initQueues buffer) goes
+ * to out of line call of same api. Root layout is that of as_root
+ * in queue.c.
+ *
+ * Complexity: O(1) as their out of line variants
+ */
+typedef struct __attribute__((packed))
+{
+    unsigned char data[5];
+    unsigned char head;     // 0 - single root, data is in root only
+    unsigned char tail;
+    unsigned char cnth : 4; // bytes in head, above 8 - not plain head
+    unsigned char cntt : 4; // bytes in tail or root, above 8 - not plain tail
+} queueRoot_t;
+
+extern unsigned char* queueInlineBuf;   // initQueues buffer, node i at 8 * i
+extern unsigned int   queueInlineNodes; // nodes in it
+
+static inline int queue_inline_push(Q* q, unsigned char b)
+{
+#ifdef QUEUE_TRACE
+    return 0; // every call is traced out of line
+#endif
+    queueRoot_t* r = (queueRoot_t*) q;
+    unsigned int cnt = r->cntt;
+
+    if (r->head == 0)
+    {
+        if (cnt == 0 || cnt == 5) // gets ready or needs node
+            return 0;
+        r->data[cnt] = b;
+        r->cntt = cnt + 1;
+        return 1;
+    }
+
+    if (cnt >= 8 || r->tail >= queueInlineNodes)
+        return 0;
+    queueInlineBuf[r->tail * 8 + cnt] = b;
+    r->cntt = cnt + 1;
+    return 1;
+}
+
+static inline int queue_inline_pop(Q* q, unsigned char* b)
+{
+#ifdef QUEUE_TRACE
+    return 0;
+#endif
+    queueRoot_t* r = (queueRoot_t*) q;
+
+    if (r->head == 0)
+    {
+        unsigned int cnt = r->cntt;
+        if (cnt <= 1) // empty or gets empty
+            return 0;
+        *b = r->data[0];
+        for (unsigned int i = 0; i < 4; i++)
+            r->data[i] = r->data[i + 1];
+        r->cntt = cnt - 1;
+        return 1;
+    }
+
+    unsigned int cnt = r->cnth;
+    if (cnt < 2 || cnt > 7 || r->head == r->tail || r->head >= queueInlineNodes)
+        return 0;
+
+    // root takes first byte of head, next byte of head stays
+    unsigned char* h = queueInlineBuf + r->head * 8;
+    *b = r->data[0];
+    for (unsigned int i = 0; i < 4; i++)
+        r->data[i] = r->data[i + 1];
+    r->data[4] = h[0];
+    for (unsigned int i = 0; i < 6; i++)
+        h[i] = h[i + 1];
+    r->cnth = cnt - 1;
+    return 1;
+}
+
+static inline void enqueueByteInline(Q* q, unsigned char b)
+{
+    if (!queue_inline_push(q, b))
+        enqueueByte(q, b);
+}
+
+static inline unsigned char dequeueByteInline(Q* q)
+{
+    unsigned char b;
+    if (!queue_inline_pop(q, &b))
+        b = dequeueByte(q);
+    return b;
+}
+
+static inline queueStatus_t tryEnqueueInline(Q* q, unsigned char b)
+{
+    return queue_inline_push(q, b) ? QUEUE_OK : tryEnqueue(q, b);
+}
+
+static inline queueStatus_t tryDequeueInline(Q* q, unsigned char* b)
+{
+    return queue_inline_pop(q, b) ? QUEUE_OK : tryDequeue(q, b);
+}
+
+#endif // QUEUE_INLINE
+
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // QUEUE_H
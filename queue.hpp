@@ -0,0 +1,183 @@
+/*
+
+ Byte queue library, C++ interface
+
+ Copyright © 2017 Eugene Mihailenco <mihailencoe@gmail.com>
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef QUEUE_HPP
+#define QUEUE_HPP
+
+#if __cplusplus < 202002L
+#error "queue.hpp needs C++20 (std::span)"
+#endif
+
+#include "queue.h"
+
+#include <cstddef>
+#include <iterator>
+#include <span>
+#include <utility>
+
+namespace queue
+{
+
+/*
+ *     Contiguous piece of queue data seen by ByteQueue::segments(),
+ * see queueSegment_t. bytes() is empty for run and spilled data,
+ * run() tells byte repeated size() times then.
+ */
+class Segment
+{
+public:
+    std::span<const std::byte> bytes() const noexcept
+    {
+        return { reinterpret_cast<const std::byte*>(seg_.data), seg_.data ? seg_.len : 0 };
+    }
+    std::size_t size() const noexcept { return seg_.len; }
+    bool is_run() const noexcept { return seg_.data == nullptr && !seg_.spilled; }
+    bool is_spilled() const noexcept { return seg_.spilled; }
+    std::byte run() const noexcept { return std::byte{ seg_.b }; }
+
+private:
+    friend class SegmentIterator;
+    queueSegment_t seg_{};
+};
+
+/*
+ *     Input iterator over segments of queue, in queue order. Queue
+ * must not be changed while it is walked.
+ */
+class SegmentIterator
+{
+public:
+    using iterator_concept = std::input_iterator_tag;
+    using value_type = Segment;
+    using difference_type = std::ptrdiff_t;
+
+    SegmentIterator() noexcept = default;
+    explicit SegmentIterator(Q* q) noexcept : q_(q) { ++*this; }
+
+    const Segment& operator*() const noexcept { return cur_; }
+    const Segment* operator->() const noexcept { return &cur_; }
+
+    SegmentIterator& operator++() noexcept
+    {
+        if (!nextQueueSegment(q_, &it_, &cur_.seg_))
+            q_ = nullptr;
+        return *this;
+    }
+    void operator++(int) noexcept { ++*this; }
+
+    friend bool operator==(const SegmentIterator& i, std::default_sentinel_t) noexcept
+    {
+        return i.q_ == nullptr;
+    }
+
+private:
+    Q*           q_ = nullptr; // nullptr - past last segment
+    unsigned int it_ = QUEUE_SEGMENTS_BEGIN;
+    Segment      cur_;
+};
+
+/*
+ *     Owning handle of queue, move only; queue is destroyed with it.
+ * Calls are inline forwards to C api (*Inline byte api in QUEUE_INLINE
+ * build), errors are returned as status/count as try* api does, no
+ * callbacks and no exceptions. Default constructed ByteQueue creates
+ * queue, which is false if arena was out of nodes.
+ */
+class ByteQueue
+{
+public:
+    ByteQueue() noexcept : q_(tryCreateQueue()) {}
+    explicit ByteQueue(Q* q) noexcept : q_(q) {} // takes ownership
+    ~ByteQueue() { reset(); }
+
+    ByteQueue(const ByteQueue&) = delete;
+    ByteQueue& operator=(const ByteQueue&) = delete;
+
+    ByteQueue(ByteQueue&& o) noexcept : q_(std::exchange(o.q_, nullptr)) {}
+    ByteQueue& operator=(ByteQueue&& o) noexcept
+    {
+        if (this != &o)
+        {
+            reset();
+            q_ = std::exchange(o.q_, nullptr);
+        }
+        return *this;
+    }
+
+    explicit operator bool() const noexcept { return q_ != nullptr; }
+    Q* get() const noexcept { return q_; }
+    Q* release() noexcept { return std::exchange(q_, nullptr); }
+
+    void reset(Q* q = nullptr) noexcept
+    {
+        if (q_ != nullptr)
+            destroyQueue(q_);
+        q_ = q;
+    }
+
+    queueStatus_t push(std::byte b) noexcept
+    {
+#ifdef QUEUE_INLINE
+        return tryEnqueueInline(q_, static_cast<unsigned char>(b));
+#else
+        return tryEnqueue(q_, static_cast<unsigned char>(b));
+#endif
+    }
+
+    queueStatus_t pop(std::byte& b) noexcept
+    {
+        unsigned char* p = reinterpret_cast<unsigned char*>(&b);
+#ifdef QUEUE_INLINE
+        return tryDequeueInline(q_, p);
+#else
+        return tryDequeue(q_, p);
+#endif
+    }
+
+    // puts as much of src as fits, returns number of bytes put
+    std::size_t push(std::span<const std::byte> src) noexcept
+    {
+        return tryEnqueueBytes(q_, reinterpret_cast<const unsigned char*>(src.data()), src.size());
+    }
+
+    // takes up to dst.size() bytes, returns number of bytes taken
+    std::size_t pop_into(std::span<std::byte> dst) noexcept
+    {
+        return tryDequeueBytes(q_, reinterpret_cast<unsigned char*>(dst.data()), dst.size());
+    }
+
+    struct Segments
+    {
+        Q* q;
+        SegmentIterator begin() const noexcept { return SegmentIterator(q); }
+        std::default_sentinel_t end() const noexcept { return {}; }
+    };
+
+    // queue data without dequeuing it: for (const auto& s : q.segments())
+    Segments segments() const noexcept { return { q_ }; }
+
+private:
+    Q* q_;
+};
+
+} // namespace queue
+
+#endif // QUEUE_HPP
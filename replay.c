@@ -0,0 +1,239 @@
+
+
+#include "queue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdint.h>
+
+/*
+ Workload replay driver (make replay), reads trace and runs it on
+ library twice: untimed for throughput, then timing every operation
+ for latency percentiles. Trace is text, one operation per line:
+
+     c <id>        createQueue
+     x <id>        destroyQueue
+     e <id> [n]    tryEnqueue, or tryEnqueueBytes of n bytes
+     d <id> [n]    tryDequeue, or tryDequeueBytes of n bytes
+     # ...         comment
+
+ id is 0..255, queue slot of trace. Failed operations (out of memory,
+ empty queue, unknown id) are counted, not fatal, so traces captured
+ on bigger arena still replay. gen_trace.py synthesizes traces.
+
+ Usage: queue-replay trace.txt [arena bytes]
+ arena bytes is multiple of QUEUE_SEGMENT_SIZE up to MAX_ARENA.
+*/
+
+#define MAX_QUEUES 256
+#define MAX_BULK   4096
+#define MAX_ARENA  2048 // 256 nodes, most initQueues takes
+
+enum { OP_CREATE, OP_DESTROY, OP_ENQ, OP_DEQ, OP_KINDS };
+
+typedef struct
+{
+    unsigned char  kind;
+    unsigned char  id;
+    unsigned short len; // 0 - single byte op
+} op_t;
+
+static const char* op_names[OP_KINDS] = { "create", "destroy", "enqueue", "dequeue" };
+
+static unsigned char* arena;
+static unsigned int   arena_len = MAX_ARENA;
+static Q*             queues[MAX_QUEUES];
+static unsigned char  bulk[MAX_BULK];
+static unsigned int   failed;
+
+static void onNothing()
+{
+}
+
+static op_t* load_trace(const char* path, unsigned int* n)
+{
+    FILE* f = fopen(path, "rt");
+    if (f == NULL)
+        return NULL;
+
+    unsigned int cap = 1024;
+    op_t* ops = malloc(cap * sizeof(op_t));
+    char line[128];
+    *n = 0;
+
+    for (unsigned int ln = 1; fgets(line, sizeof(line), f) != NULL; ln++)
+    {
+        char k;
+        unsigned int id, len = 0;
+        int got = sscanf(line, " %c %u %u", &k, &id, &len);
+        if (got <= 0 || k == '#')
+            continue;
+
+        const char* kinds = "cxed";
+        const char* at = strchr(kinds, k);
+        if (got < 2 || at == NULL || id >= MAX_QUEUES || len > MAX_BULK)
+        {
+            fprintf(stderr, "%s:%u: bad operation\n", path, ln);
+            fclose(f);
+            free(ops);
+            return NULL;
+        }
+
+        if (*n == cap)
+            ops = realloc(ops, (cap *= 2) * sizeof(op_t));
+        ops[(*n)++] = (op_t){ .kind = at - kinds, .id = id, .len = len };
+    }
+
+    fclose(f);
+    return ops;
+}
+
+static inline void run_op(const op_t* op)
+{
+    Q** q = &queues[op->id];
+
+    if (op->kind == OP_CREATE)
+    {
+        if (*q == NULL && (*q = createQueue()) != NULL)
+            return;
+    }
+    else if (*q == NULL)
+    {
+        // op on queue trace failed to create
+    }
+    else if (op->kind == OP_DESTROY)
+    {
+        destroyQueue(*q);
+        *q = NULL;
+        return;
+    }
+    else if (op->kind == OP_ENQ)
+    {
+        if (op->len == 0 ? tryEnqueue(*q, op->id) == QUEUE_OK
+                         : tryEnqueueBytes(*q, bulk, op->len) == op->len)
+            return;
+    }
+    else
+    {
+        unsigned char b;
+        if (op->len == 0 ? tryDequeue(*q, &b) == QUEUE_OK
+                         : tryDequeueBytes(*q, bulk, op->len) == op->len)
+            return;
+    }
+
+    failed++;
+}
+
+static void reset()
+{
+    initQueues(arena, arena_len);
+    setOutOfMemoryCallback(onNothing);
+    setIllegalOperationCallback(onNothing);
+    memset(queues, 0, sizeof(queues));
+    failed = 0;
+}
+
+static inline uint64_t now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_u32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 2)
+    {
+        char* end;
+        long len = strtol(argv[2], &end, 10);
+        arena_len = *end == '\0' && len > 0 && len <= MAX_ARENA
+                    && len % QUEUE_SEGMENT_SIZE == 0 ? len : 0;
+    }
+    if (argc < 2 || argc > 3 || arena_len == 0)
+    {
+        fprintf(stderr, "usage: %s trace.txt [arena bytes]\n"
+                        "arena bytes is multiple of %d up to %d\n",
+                argv[0], QUEUE_SEGMENT_SIZE, MAX_ARENA);
+        return 2;
+    }
+
+    unsigned int n;
+    op_t* ops = load_trace(argv[1], &n);
+    if (ops == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    arena = aligned_alloc(64, (arena_len + 63) & ~63u);
+    for (unsigned int i = 0; i < MAX_BULK; i++)
+        bulk[i] = i;
+
+    // count bytes moved, bulk ops may move less on failure
+    uint64_t bytes = 0;
+    unsigned int count[OP_KINDS] = { 0 };
+    for (unsigned int i = 0; i < n; i++)
+    {
+        count[ops[i].kind]++;
+        if (ops[i].kind >= OP_ENQ)
+            bytes += ops[i].len != 0 ? ops[i].len : 1;
+    }
+
+    // throughput, whole trace untimed
+    reset();
+    uint64_t t0 = now_ns();
+    for (unsigned int i = 0; i < n; i++)
+        run_op(&ops[i]);
+    uint64_t total = now_ns() - t0;
+
+    printf("%u ops (%u create, %u destroy, %u enqueue, %u dequeue), %u failed\n",
+           n, count[OP_CREATE], count[OP_DESTROY], count[OP_ENQ], count[OP_DEQ], failed);
+    printf("%.1f ms, %.2f Mops/s, %.1f MB/s\n", total / 1e6,
+           n * 1e3 / (total ? total : 1), bytes * 1e3 / (total ? total : 1));
+
+    // latency, every op timed, clock cost taken out
+    uint32_t* lat[OP_KINDS];
+    unsigned int at[OP_KINDS] = { 0 };
+    for (unsigned int k = 0; k < OP_KINDS; k++)
+        lat[k] = malloc((count[k] + 1) * sizeof(uint32_t));
+
+    uint64_t clock_cost = now_ns();
+    for (int i = 0; i < 1000; i++)
+        now_ns();
+    clock_cost = (now_ns() - clock_cost) / 1001;
+
+    reset();
+    for (unsigned int i = 0; i < n; i++)
+    {
+        uint64_t b = now_ns();
+        run_op(&ops[i]);
+        uint64_t d = now_ns() - b;
+        lat[ops[i].kind][at[ops[i].kind]++] = d > clock_cost ? d - clock_cost : 0;
+    }
+
+    printf("%-8s %10s %8s %8s %8s %8s %8s (ns, clock %u ns taken out)\n",
+           "op", "count", "p50", "p90", "p99", "p99.9", "max", (unsigned int) clock_cost);
+    for (unsigned int k = 0; k < OP_KINDS; k++)
+    {
+        unsigned int c = count[k];
+        if (c == 0)
+            continue;
+        qsort(lat[k], c, sizeof(uint32_t), cmp_u32);
+        printf("%-8s %10u %8u %8u %8u %8u %8u\n", op_names[k], c,
+               lat[k][c * 50 / 100], lat[k][c * 90 / 100], lat[k][c * 99 / 100],
+               lat[k][(uint64_t) c * 999 / 1000], lat[k][c - 1]);
+        free(lat[k]);
+    }
+
+    free(ops);
+    free(arena);
+    return 0;
+}
@@ -0,0 +1,243 @@
+
+
+#include "queue.hpp"
+
+#include <cstdio>
+#include <cstdarg>
+#include <cstddef>
+#include <csetjmp>
+#include <cmocka.h>
+#include <ctime>
+#include <cstring>
+#include <vector>
+#include <type_traits>
+
+
+#define BUFFER_LIMIT 2048
+static unsigned char buffer[BUFFER_LIMIT];
+
+using queue::ByteQueue;
+
+// handle is just Q*, so passing it around costs what Q* does
+static_assert(sizeof(ByteQueue) == sizeof(Q*));
+static_assert(!std::is_copy_constructible_v<ByteQueue>);
+static_assert(std::is_nothrow_move_constructible_v<ByteQueue>);
+static_assert(std::input_iterator<queue::SegmentIterator>);
+static_assert(std::ranges::input_range<ByteQueue::Segments>);
+
+static unsigned int idle_nodes()
+{
+    queueArenaStats_t s;
+    getArenaStats(nullptr, 0, &s);
+    return s.free_nodes + s.bump_nodes;
+}
+
+static void test_0(void **state) // ownership
+{
+    (void) state; // unused
+
+    unsigned int idle = idle_nodes();
+    {
+        ByteQueue a;
+        assert_true(a);
+        for (int i = 0; i < 100; i++)
+            assert_int_equal(a.push(std::byte(i)), QUEUE_OK);
+
+        ByteQueue b(std::move(a));
+        assert_false(a);
+        assert_true(b);
+
+        ByteQueue c;
+        c = std::move(b); // c's own queue is destroyed
+        std::byte v;
+        assert_int_equal(c.pop(v), QUEUE_OK);
+        assert_int_equal(std::to_integer<int>(v), 0);
+
+        Q* q = c.release();
+        ByteQueue d(q);
+        assert_ptr_equal(d.get(), q);
+    }
+    assert_int_equal(idle_nodes(), idle);
+}
+
+static void test_1(void **state) // span bulk io
+{
+    (void) state; // unused
+
+    ByteQueue q;
+    std::vector<std::byte> src(1000), dst(1000);
+    for (size_t i = 0; i < src.size(); i++)
+        src[i] = std::byte(i * 7);
+
+    assert_int_equal(q.push(src), src.size());
+    assert_int_equal(q.pop_into(std::span(dst).first(10)), 10);
+    assert_int_equal(q.pop_into(std::span(dst).subspan(10)), 990);
+    assert_true(src == dst);
+
+    std::byte b;
+    assert_int_equal(q.pop_into(dst), 0);
+    assert_int_equal(q.pop(b), QUEUE_EMPTY);
+
+    // partial when arena is out of nodes
+    std::vector<std::byte> big(BUFFER_LIMIT);
+    size_t put = q.push(big);
+    assert_true(put > 0 && put < big.size());
+    assert_int_equal(q.pop_into(big), put);
+}
+
+static void test_2(void **state) // segments
+{
+    (void) state; // unused
+
+    ByteQueue q;
+    ByteQueue r;
+    setQueueFlags(r.get(), QUEUE_FLAG_RLE);
+
+    assert_true(q.segments().begin() == std::default_sentinel);
+
+    for (int i = 0; i < 300; i++)
+    {
+        q.push(std::byte(i));
+        r.push(std::byte(i < 200 ? 1 : i));
+    }
+
+    std::vector<std::byte> seen;
+    int segs = 0;
+    for (const auto& s : q.segments())
+    {
+        assert_false(s.is_run() || s.is_spilled());
+        assert_int_equal(s.bytes().size(), s.size());
+        seen.insert(seen.end(), s.bytes().begin(), s.bytes().end());
+        segs++;
+    }
+    assert_int_equal(seen.size(), 300);
+    assert_true(segs > 1);
+    for (int i = 0; i < 300; i++)
+        assert_int_equal(std::to_integer<int>(seen[i]), i & 0xFF);
+
+    // runs show up as byte and count, data stays in queue
+    size_t runs = 0, total = 0;
+    for (const auto& s : r.segments())
+    {
+        if (s.is_run())
+        {
+            runs++;
+            assert_int_equal(std::to_integer<int>(s.run()), 1);
+        }
+        total += s.size();
+    }
+    assert_int_equal(total, 300);
+    assert_true(runs >= 1);
+
+    std::byte b;
+    assert_int_equal(r.pop(b), QUEUE_OK);
+    assert_int_equal(std::to_integer<int>(b), 1);
+}
+
+static void test_3(void **state) // arena out of nodes
+{
+    (void) state; // unused
+
+    // no callbacks set: handle is just false when arena runs out
+    std::vector<ByteQueue> qs;
+    for (int i = 0; i < 1000; i++)
+    {
+        qs.emplace_back();
+        if (!qs.back())
+            break;
+    }
+    assert_false(qs.back());
+    assert_true(qs.size() > 1 && qs.size() < 1000);
+
+    qs.pop_back();
+    qs.pop_back();
+    ByteQueue again;
+    assert_true(again);
+}
+
+static double elapsed_ns(struct timespec* begin, struct timespec* end)
+{
+    return (end->tv_sec - begin->tv_sec) * 1e9 + (end->tv_nsec - begin->tv_nsec);
+}
+
+static void perf_test_0() // wrapper vs C api, byte and bulk
+{
+    const int N = 48;    // bytes per round, plain nodes only
+    const int R = 200000; // rounds
+    unsigned int s = 0;  // optimization killer
+
+    struct timespec begin, end;
+    Q* c = createQueue();
+    ByteQueue w;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int r = 0; r < R; r++)
+    {
+        for (int i = 0; i < N; i++)
+            tryEnqueue(c, i);
+        for (int i = 0; i < N; i++)
+        {
+            unsigned char b;
+            tryDequeue(c, &b);
+            s += b;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    double c_byte = elapsed_ns(&begin, &end) / (N * R);
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int r = 0; r < R; r++)
+    {
+        for (int i = 0; i < N; i++)
+            w.push(std::byte(i));
+        for (int i = 0; i < N; i++)
+        {
+            std::byte b;
+            w.pop(b);
+            s += std::to_integer<unsigned int>(b);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    double w_byte = elapsed_ns(&begin, &end) / (N * R);
+
+    unsigned char buf[N];
+    std::byte wbuf[N];
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int r = 0; r < R; r++)
+    {
+        tryEnqueueBytes(c, buf, N);
+        s += tryDequeueBytes(c, buf, N);
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    double c_bulk = elapsed_ns(&begin, &end) / R;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (int r = 0; r < R; r++)
+    {
+        w.push(wbuf);
+        s += w.pop_into(wbuf);
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    double w_bulk = elapsed_ns(&begin, &end) / R;
+
+    printf("byte push+pop: C api %.1f ns, ByteQueue %.1f ns\n", c_byte, w_byte);
+    printf("%d byte bulk push+pop: C api %.1f ns, ByteQueue %.1f ns\ns=%u\n", N, c_bulk, w_bulk, s);
+
+    destroyQueue(c);
+}
+
+int main(void)
+{
+    initQueues(buffer, BUFFER_LIMIT);
+
+    perf_test_0();
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_0), // ownership
+        cmocka_unit_test(test_1), // span bulk io
+        cmocka_unit_test(test_2), // segments
+        cmocka_unit_test(test_3), // arena out of nodes
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}